@@ -0,0 +1,332 @@
+// Benchmark suite for the quadtree compressor. Prints one JSON document on
+// stdout so results from two versions can be compared by a script; progress
+// goes to stderr.
+//
+//   bin/bench [--quick] [--repeat N] [--warmup N] [--images DIR]
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ImageCompressor.hpp"
+#include "IntegralImage.hpp"
+#include "MetricKernels.hpp"
+#include "Quadtree.hpp"
+#include "QuadtreeQuery.hpp"
+
+namespace {
+
+struct BenchConfig {
+  bool quick = false;
+  int repeat = 7;
+  int warmup = 2;
+  std::string imageDir = "test";
+};
+
+struct Summary {
+  double median, p95;
+};
+
+const char* kMetricNames[] = {"",        "variance", "mad",     "maxdiff",
+                              "entropy", "ssim",     "ssim-rgb"};
+
+const BuildEngine kEngines[] = {BuildEngine::TopDown, BuildEngine::BottomUp};
+const char* kEngineNames[] = {"top-down", "bottom-up"};
+
+// Thresholds that give shallow, medium and deep trees for each metric.
+const std::vector<double> kThresholds[] = {
+    {},        {800, 200, 50},  {40, 15, 5},    {150, 60, 20},
+    {5, 3, 1}, {0.9, 0.5, 0.1}, {0.9, 0.5, 0.1}};
+
+// Run fn warmup times untimed, then repeat times, and summarise the timings
+// in the given unit (seconds per unit).
+Summary measure(const BenchConfig& config, double unit,
+                const std::function<void()>& fn) {
+  for (int i = 0; i < config.warmup; i++) fn();
+  std::vector<double> samples;
+  for (int i = 0; i < config.repeat; i++) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    samples.push_back(elapsed.count() / unit);
+  }
+  std::sort(samples.begin(), samples.end());
+  size_t p95 = static_cast<size_t>(std::ceil(0.95 * samples.size())) - 1;
+  return Summary{samples[samples.size() / 2], samples[p95]};
+}
+
+// Synthetic inputs: uniform noise (worst case, splits everywhere), a smooth
+// diagonal gradient, and flat rectangles with mild noise (best case).
+Image makeImage(const std::string& kind, int size) {
+  Image image(size, size);
+  std::mt19937 rng(size);
+  for (int y = 0; y < size; y++) {
+    for (int c = 0; c < 3; c++) {
+      uint8_t* row = image.row(c, y);
+      for (int x = 0; x < size; x++) {
+        int value;
+        if (kind == "noise")
+          value = rng() & 0xff;
+        else if (kind == "gradient")
+          value = (x + y + 64 * c) * 255 / (2 * size + 128);
+        else
+          value = ((x * 5 / size + y * 3 / size + c) % 4) * 60 + rng() % 4;
+        row[x] = static_cast<uint8_t>(value);
+      }
+    }
+  }
+  return image;
+}
+
+class JsonResults {
+ private:
+  bool first = true;
+
+ public:
+  void begin() {
+    printf("{\n  \"isa\": \"%s\",\n  \"hardware_threads\": %u,\n",
+           MetricKernels::isaName(MetricKernels::activeIsa()),
+           std::thread::hardware_concurrency());
+    printf("  \"results\": [");
+  }
+  void add(const std::string& fields) {
+    printf("%s\n    {%s}", first ? "" : ",", fields.c_str());
+    fflush(stdout);
+    first = false;
+  }
+  void end() { printf("\n  ]\n}\n"); }
+};
+
+std::string format(const char* pattern, ...)
+    __attribute__((format(printf, 1, 2)));
+std::string format(const char* pattern, ...) {
+  char buffer[512];
+  va_list args;
+  va_start(args, pattern);
+  vsnprintf(buffer, sizeof(buffer), pattern, args);
+  va_end(args);
+  return buffer;
+}
+
+// Time Metric::compute on random blocks of one size in a noise image.
+void benchMetrics(const BenchConfig& config, JsonResults& results) {
+  Image image = makeImage("noise", 1024);
+  ImageView view = image.view();
+  std::vector<int> sizes = {4, 8, 16, 32, 64, 128, 256};
+  if (config.quick) sizes = {8, 64};
+
+  for (int method = 1; method <= 6; method++) {
+    std::unique_ptr<Metric> metric = createMetric(method);
+    IntegralImage integral(view, metric->squareSums());
+    metric->setIntegralImage(&integral);
+    for (int size : sizes) {
+      std::mt19937 rng(size);
+      std::vector<std::pair<int, int>> blocks(256);
+      for (auto& block : blocks)
+        block = {static_cast<int>(rng() % (1024 - size)),
+                 static_cast<int>(rng() % (1024 - size))};
+      // Enough calls per sample to touch about four megapixels.
+      int calls = std::max(256, (4 << 20) / (size * size));
+      volatile double sink = 0;
+      Summary summary = measure(config, 1e-9 * calls, [&] {
+        for (int i = 0; i < calls; i++) {
+          const auto& block = blocks[i & 255];
+          sink = sink + metric->compute(view, block.first, block.second,
+                                        size, size);
+        }
+      });
+      results.add(format("\"suite\": \"metric\", \"metric\": \"%s\", "
+                         "\"block\": %d, \"median_ns\": %.1f, "
+                         "\"p95_ns\": %.1f",
+                         kMetricNames[method], size, summary.median,
+                         summary.p95));
+    }
+  }
+}
+
+// Time complete quadtree builds for every image, metric, threshold and
+// engine, then the thread scaling of one mid-range configuration per image.
+void benchBuilds(const BenchConfig& config, JsonResults& results) {
+  std::vector<std::pair<std::string, Image>> images;
+  std::vector<int> sizes = {256, 512, 1024};
+  if (config.quick) sizes = {256, 512};
+  for (const char* kind : {"noise", "gradient", "flat"})
+    for (int size : sizes)
+      images.emplace_back(std::string(kind) + "-" + std::to_string(size),
+                          makeImage(kind, size));
+
+  std::vector<std::string> files;
+  if (std::filesystem::is_directory(config.imageDir))
+    for (const auto& entry :
+         std::filesystem::directory_iterator(config.imageDir))
+      if (entry.is_regular_file()) files.push_back(entry.path().string());
+  std::sort(files.begin(), files.end());
+  for (const std::string& file : files) {
+    try {
+      images.emplace_back(std::filesystem::path(file).filename().string(),
+                          loadImage(file));
+    } catch (const std::exception& e) {
+      std::cerr << "[bench] skipping " << file << ": " << e.what()
+                << std::endl;
+    }
+  }
+
+  std::vector<int> threadCounts = {1, 2, 4};
+  int hardware = static_cast<int>(std::thread::hardware_concurrency());
+  if (hardware > 4) threadCounts.push_back(hardware);
+
+  for (const auto& entry : images) {
+    ImageView view = entry.second.view();
+    std::cerr << "[bench] " << entry.first << std::endl;
+    for (int method = 1; method <= 6; method++) {
+      for (double threshold : kThresholds[method]) {
+        for (int engine = 0; engine < 2; engine++) {
+          std::unique_ptr<Metric> metric = createMetric(method);
+          BuildOptions options;
+          options.engine = kEngines[engine];
+          size_t nodes = 0;
+          Summary summary = measure(config, 1e-3, [&] {
+            Quadtree tree(view, threshold, metric.get(), 4, options);
+            nodes = tree.getNodes().size();
+          });
+          results.add(format(
+              "\"suite\": \"build\", \"image\": \"%s\", \"pixels\": %lld, "
+              "\"metric\": \"%s\", \"threshold\": %g, \"engine\": \"%s\", "
+              "\"threads\": 1, \"nodes\": %zu, \"median_ms\": %.3f, "
+              "\"p95_ms\": %.3f",
+              entry.first.c_str(),
+              static_cast<long long>(view.getWidth()) * view.getHeight(),
+              kMetricNames[method], threshold, kEngineNames[engine], nodes,
+              summary.median, summary.p95));
+        }
+      }
+    }
+
+    double threshold = kThresholds[1][1];
+    std::unique_ptr<Metric> metric = createMetric(1);
+    for (int threads : threadCounts) {
+      if (config.quick && threads > 2) break;
+      BuildOptions options;
+      options.threadCount = threads;
+      Summary summary = measure(config, 1e-3, [&] {
+        Quadtree tree(view, threshold, metric.get(), 4, options);
+      });
+      results.add(format(
+          "\"suite\": \"scaling\", \"image\": \"%s\", \"metric\": "
+          "\"variance\", \"threshold\": %g, \"threads\": %d, "
+          "\"median_ms\": %.3f, \"p95_ms\": %.3f",
+          entry.first.c_str(), threshold, threads, summary.median,
+          summary.p95));
+    }
+  }
+}
+
+// Time best-first builds under growing leaf budgets on the largest
+// synthetic image, at threshold 0 so only the budget stops the build.
+void benchBudgets(const BenchConfig& config, JsonResults& results) {
+  int size = config.quick ? 512 : 1024;
+  Image image = makeImage("gradient", size);
+  std::unique_ptr<Metric> metric = createMetric(1);
+  std::cerr << "[bench] budgets on gradient-" << size << std::endl;
+  for (long long budget : {1000, 10000, 100000}) {
+    BuildOptions options;
+    options.engine = BuildEngine::BestFirst;
+    options.maxLeaves = budget;
+    long long leaves = 0;
+    Summary summary = measure(config, 1e-3, [&] {
+      Quadtree tree(image.view(), 0, metric.get(), 4, options);
+      leaves = tree.getLeafCount();
+    });
+    results.add(format("\"suite\": \"budget\", \"size\": %d, "
+                       "\"max_leaves\": %lld, \"leaves\": %lld, "
+                       "\"median_ms\": %.3f, \"p95_ms\": %.3f",
+                       size, budget, leaves, summary.median, summary.p95));
+  }
+}
+
+// Time queries on one deep tree: point lookups, leaves over small windows,
+// and renders at the source size and as a small preview.
+void benchQueries(const BenchConfig& config, JsonResults& results) {
+  int size = config.quick ? 1024 : 2048;
+  Image image = makeImage("gradient", size);
+  std::unique_ptr<Metric> metric = createMetric(1);
+  Quadtree tree(image.view(), 0, metric.get(), 4);
+  QuadtreeQuery query(tree);
+  std::cerr << "[bench] queries on gradient-" << size << std::endl;
+
+  std::mt19937 rng(size);
+  std::vector<std::pair<int, int>> points(4096);
+  for (auto& point : points)
+    point = {static_cast<int>(rng() % size), static_cast<int>(rng() % size)};
+  volatile int sink = 0;
+  auto report = [&](const char* name, int calls, const Summary& summary) {
+    results.add(format("\"suite\": \"query\", \"query\": \"%s\", "
+                       "\"size\": %d, \"calls\": %d, \"median_ns\": %.1f, "
+                       "\"p95_ns\": %.1f",
+                       name, size, calls, summary.median, summary.p95));
+  };
+
+  report("color_at", 4096, measure(config, 1e-9 * 4096, [&] {
+           for (const auto& point : points)
+             sink = sink + query.colorAt(point.first, point.second).r;
+         }));
+  report("leaves_64", 256, measure(config, 1e-9 * 256, [&] {
+           for (int i = 0; i < 256; i++)
+             query.forEachLeaf(points[i].first, points[i].second, 64, 64,
+                               [&](const Block&, const QuadtreeNode& node) {
+                                 sink = sink + node.r;
+                               });
+         }));
+  for (int output : {size, 256}) {
+    std::vector<uint8_t> pixels(static_cast<size_t>(output) * output * 3);
+    PixelBuffer target{pixels.data(), static_cast<size_t>(output) * 3, output,
+                       output, 3};
+    report(output == size ? "render_full" : "render_256", 1,
+           measure(config, 1e-9, [&] { query.render(target); }));
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchConfig config;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--quick") {
+      config.quick = true;
+    } else if (arg == "--repeat" && i + 1 < argc) {
+      config.repeat = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--warmup" && i + 1 < argc) {
+      config.warmup = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--images" && i + 1 < argc) {
+      config.imageDir = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--quick] [--repeat N] [--warmup N] [--images DIR]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  FreeImage_Initialise();
+  JsonResults results;
+  results.begin();
+  benchMetrics(config, results);
+  benchBuilds(config, results);
+  benchBudgets(config, results);
+  benchQueries(config, results);
+  results.end();
+  FreeImage_DeInitialise();
+  return 0;
+}
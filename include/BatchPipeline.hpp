@@ -0,0 +1,70 @@
+#ifndef __BATCHPIPELINE_HPP__
+#define __BATCHPIPELINE_HPP__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ImageCompressor.hpp"
+#include "Quadtree.hpp"
+
+struct BatchOptions {
+  int errorMethod = 1;
+  double threshold = 10;
+  int minBlockSize = 4;
+  double targetCompression = 0;
+  std::string outputDir;
+  OutputFormat format = OutputFormat::Jpeg;
+  bool writeGif = false;
+  std::string statsPath;  // JSON array of per-image stats, if set
+  BuildOptions build;
+
+  // Workers per stage and the capacity of the queue in front of each stage.
+  int decodeWorkers = 2;
+  // Each builder holds an image with its tables and tree, so the default is
+  // small; 0 uses one per hardware thread.
+  int buildWorkers = 2;
+  int rasterWorkers = 1;
+  int encodeWorkers = 2;
+  int queueDepth = 4;
+
+  // Above 0, images are compressed out of core, one at a time, in tiles of
+  // at most this many pixels on a side (see TiledCompressor).
+  int tileSize = 0;
+
+  // Above 0, the inputs are frames of one sequence, compressed in order by
+  // rebuilding only the tiles of this size that changed since the previous
+  // frame (see SequenceCompressor).
+  int sequenceTileSize = 0;
+};
+
+// Compresses many images with the settings of BatchOptions. Each image flows
+// through four stages (decode, quadtree build, rasterize, encode), each with
+// its own worker threads and a bounded queue in front of it, so reading and
+// writing files overlaps with building trees. An image that fails at any
+// stage is reported and dropped; the rest of the batch carries on. In tiled
+// and sequence modes the stages are skipped and each image goes through
+// TiledCompressor or SequenceCompressor.
+class BatchPipeline {
+ private:
+  BatchOptions options;
+  std::unique_ptr<ThreadPool> pool;  // lent to every build, paint and GIF
+
+  int runTiled(const std::vector<std::string>& inputs);
+  int runSequence(const std::vector<std::string>& inputs);
+
+ public:
+  explicit BatchPipeline(const BatchOptions& options);
+
+  // Expand the command-line inputs: directories contribute the image files
+  // they contain, in name order, and list files (one path per line, "-" for
+  // stdin) contribute their lines.
+  static std::vector<std::string> collectInputs(
+      const std::vector<std::string>& paths,
+      const std::vector<std::string>& listFiles);
+
+  // Process every input and return the number of images that failed.
+  int run(const std::vector<std::string>& inputs);
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef __BOUNDEDQUEUE_HPP__
+#define __BOUNDEDQUEUE_HPP__
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Blocking FIFO with a fixed capacity, used between pipeline stages: a full
+// queue stalls its producers, which keeps a fast stage from running ahead of
+// a slow one and holding every image in memory. close() wakes everyone up;
+// consumers then drain what is left and see the end of the stream.
+template <typename T>
+class BoundedQueue {
+ private:
+  std::mutex lock;
+  std::condition_variable notFull, notEmpty;
+  std::deque<T> items;
+  size_t capacity;
+  bool closed;
+
+ public:
+  explicit BoundedQueue(size_t capacity)
+      : capacity(capacity < 1 ? 1 : capacity), closed(false) {}
+
+  // Returns false if the queue was closed before the item could be added.
+  bool push(T item) {
+    std::unique_lock<std::mutex> guard(lock);
+    notFull.wait(guard, [&] { return closed || items.size() < capacity; });
+    if (closed) return false;
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+    return true;
+  }
+
+  // Returns false once the queue is closed and empty.
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> guard(lock);
+    notEmpty.wait(guard, [&] { return closed || !items.empty(); });
+    if (items.empty()) return false;
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+  }
+
+  void close() {
+    std::lock_guard<std::mutex> guard(lock);
+    closed = true;
+    notFull.notify_all();
+    notEmpty.notify_all();
+  }
+};
+
+#endif
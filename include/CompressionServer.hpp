@@ -0,0 +1,84 @@
+#ifndef __COMPRESSIONSERVER_HPP__
+#define __COMPRESSIONSERVER_HPP__
+
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "BoundedQueue.hpp"
+#include "ImageCompressor.hpp"
+#include "Quadtree.hpp"
+
+struct ServerOptions {
+  std::string socketPath;  // listen on this Unix socket; empty for stdin
+  int workers = 0;         // 0 uses one per hardware thread
+  int queueDepth = 4;      // requests waiting per connection
+  uint64_t maxRequestBytes = uint64_t(64) << 20;  // largest input accepted
+  int maxConnections = 16;  // clients served at once on the socket
+  BuildOptions build;
+};
+
+// Compresses images sent over a connection and returns the encoded bytes on
+// the same connection. A request is one header line followed by the input
+// image, in any format the batch mode reads (.qtc included):
+//
+//   <metric> <threshold> <min-block> jpg|qtc <input bytes>\n<input>
+//
+// and is answered with "ok <output bytes>\n<output>" or "error <message>\n".
+// Responses come in request order, so a client may send several requests
+// before reading. A malformed header, or an input larger than
+// maxRequestBytes, is answered with an error and ends the connection. The
+// input is read as it arrives, so a header alone never allocates its size.
+// At most maxConnections clients are served at once; the others wait in the
+// socket's backlog.
+//
+// FreeImage is initialised once for the server's lifetime, and a fixed pool
+// of workers serves every connection. Each worker keeps its metrics, pixel
+// buffer, node arena, summed-area tables and output bitmap from one request
+// to the next, so a stream of similar images allocates almost nothing after
+// the first.
+class CompressionServer {
+ private:
+  struct Request {
+    int errorMethod;
+    double threshold;
+    int minBlockSize;
+    OutputFormat format;
+    std::vector<uint8_t> input;
+  };
+  struct Response {
+    bool ok;
+    std::string error;
+    std::vector<uint8_t> output;
+  };
+  struct Task {
+    Request request;
+    std::promise<Response> response;
+  };
+  struct Worker;
+
+  ServerOptions options;
+  std::unique_ptr<ThreadPool> pool;  // shared by every worker's builds
+  BoundedQueue<Task> tasks;
+  std::mutex connectionLock;
+  std::condition_variable connectionClosed;
+  int connections;  // served on the socket right now
+
+  void work();
+  void serveConnection(int in, int out);
+  void listen();
+
+ public:
+  explicit CompressionServer(const ServerOptions& options);
+
+  // Serve stdin and stdout until the input ends, or accept connections on
+  // the socket until an error occurs. Throws std::runtime_error if the
+  // socket cannot be set up.
+  void serve();
+};
+
+#endif
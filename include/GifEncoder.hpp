@@ -0,0 +1,56 @@
+#ifndef __GIF_ENCODER_HPP__
+#define __GIF_ENCODER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "Color.hpp"
+
+class Quadtree;
+
+// Streaming GIF89a writer with a single global palette. Each frame is a
+// rectangle of palette indices placed on the logical screen and left in place
+// for the next one, so an animation only has to send the pixels that changed.
+class GifEncoder {
+ private:
+  std::ofstream file;
+  int width, height;
+  int minCodeSize;
+
+ public:
+  GifEncoder();
+  ~GifEncoder();
+
+  // palette holds at most 256 entries; loopCount 0 repeats forever.
+  bool open(const std::string& path, int width, int height,
+            const std::vector<Color>& palette, int loopCount = 0);
+  // indices addresses the top-left pixel of the rectangle, rows top-down;
+  // delay is in hundredths of a second.
+  bool addFrame(const uint8_t* indices, size_t pitch, int x, int y, int width,
+                int height, int delay);
+  // Add a frame whose image data was already made by encodeImageData with
+  // getMinCodeSize(), which lets frames be compressed on other threads.
+  bool addEncodedFrame(const std::vector<uint8_t>& data, int x, int y,
+                       int width, int height, int delay);
+  bool close();
+  int getMinCodeSize() const { return minCodeSize; }
+
+  // LZW-compress a rectangle of indices into GIF image data: the code size
+  // byte followed by length-prefixed sub-blocks and the block terminator.
+  static std::vector<uint8_t> encodeImageData(const uint8_t* indices,
+                                              size_t pitch, int width,
+                                              int height, int minCodeSize);
+};
+
+// Write the animation of a quadtree being refined one level per frame. Frame
+// d is derived from frame d-1 by repainting only the nodes that split at depth
+// d, and only the bounding box of those nodes is encoded. With several
+// threads, consecutive frames are painted and compressed in parallel and
+// written in order as they finish; the file is the same as with one.
+bool saveQuadtreeGif(const Quadtree& tree, const std::string& path, int delay,
+                     bool outline, int threadCount = 1);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef __IMAGE_HPP__
+#define __IMAGE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Color.hpp"
+#include "ImageView.hpp"
+
+// 8-bit RGB image stored as three planes (R, G, B) in one aligned allocation.
+// Each plane row is padded to the alignment so kernels can stream whole rows
+// of a single channel from contiguous memory.
+class Image {
+ private:
+  int width, height;
+  size_t pitch;
+  size_t capacity;  // bytes allocated, at least pitch * height * 3
+  uint8_t* data;
+
+ public:
+  static const size_t kAlignment = 64;
+
+  Image();
+  Image(int width, int height);
+  Image(const Image& other);
+  Image(Image&& other) noexcept;
+  Image& operator=(Image other) noexcept;
+  ~Image();
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  size_t getPitch() const { return pitch; }
+  bool empty() const { return data == nullptr; }
+  // Change the size, keeping the allocation if it is large enough. The
+  // pixels are left uninitialised.
+  void reshape(int width, int height);
+
+  uint8_t* row(int channel, int y) {
+    return data + (static_cast<size_t>(channel) * height + y) * pitch;
+  }
+  const uint8_t* row(int channel, int y) const {
+    return data + (static_cast<size_t>(channel) * height + y) * pitch;
+  }
+  Color getPixel(int x, int y) const {
+    return Color{row(0, y)[x], row(1, y)[x], row(2, y)[x]};
+  }
+  ImageView view() const {
+    if (!data) return ImageView();
+    return ImageView(width, height, pitch, row(0, 0), row(1, 0), row(2, 0));
+  }
+};
+
+#endif
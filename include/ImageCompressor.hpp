@@ -2,20 +2,65 @@
 #define __IMAGECOMPRESSOR_HPP__
 
 #include <FreeImage.h>
-#include <sys/stat.h>
 
 #include <chrono>
+#include <cmath>
 #include <cstdlib>
+#include <fstream>
 #include <functional>
 #include <iomanip>
 #include <iostream>
-#include <sstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "Color.hpp"
+#include "GifEncoder.hpp"
+#include "Image.hpp"
 #include "Metrics.hpp"
+#include "QtcCodec.hpp"
 #include "Quadtree.hpp"
+#include "Stats.hpp"
+
+// Compressed images are either a JPEG of the rasterized tree or the tree
+// itself in the native .qtc format, chosen by the output file extension.
+enum class OutputFormat { Jpeg, Qtc };
+
+// Outcome of a target-compression search. compression is NaN if no
+// candidate could be encoded; otherwise encoded holds the output at the
+// chosen threshold, ready to be written.
+struct TargetSearch {
+  double threshold;
+  double compression;
+  int encodes;
+  std::vector<uint8_t> encoded;
+};
+
+// Building blocks shared by the interactive flow and the batch pipeline. They
+// expect FreeImage to be initialised once by the caller and report failures
+// by throwing std::runtime_error rather than exiting.
+Image loadImage(const std::string& path);
+long long loadImage(const std::string& path, Image& pixels);
+std::vector<uint8_t> readFile(const std::string& path);
+void writeFile(const std::vector<uint8_t>& data, const std::string& path);
+// Decode an image held in memory into pixels, reusing their buffer when it
+// is large enough. name identifies the image in errors.
+void decodeImage(const std::vector<uint8_t>& data, Image& pixels,
+                 const std::string& name = "image");
+void encodeJpeg(FIBITMAP* bitmap, std::vector<uint8_t>& out);
+// Encode the tree's output in the given format into out, replacing its
+// contents but keeping its capacity.
+void encodeTree(Quadtree& tree, OutputFormat format,
+                std::vector<uint8_t>& out, int threadCount = 1);
+std::unique_ptr<Metric> createMetric(int errorMethod);
+TargetSearch findTargetThreshold(Quadtree& tree, double inputBytes,
+                                 double target,
+                                 OutputFormat format = OutputFormat::Jpeg,
+                                 int threadCount = 1);
+OutputFormat outputFormatFor(const std::string& path);
 
 class ImageCompressor {
  private:
@@ -27,19 +72,27 @@ class ImageCompressor {
   double targetCompression;
   std::string outputImagePath;
   std::string gifPath;
+  std::unique_ptr<Metric> metric;  // outlives quadtree, which borrows it
   Quadtree* quadtree;
-  std::vector<std::vector<Color>> pixelData;
+  BuildOptions buildOptions;
+  Image pixelData;
+  std::vector<uint8_t> encoded;  // the output, once searched or saved
+  ByteCounts bytes;
+  RunStats stats;
+  std::string statsPath;
 
   void getInput();
   void processImage();
-  void loadImage();
+  void searchTargetCompression();
   void saveImage();
   void saveGif();
   void loadImageFromPath();
   void showStats();
-  Metric* getMetric();
+  void writeStats();
 
  public:
+  void setBuildOptions(const BuildOptions& options) { buildOptions = options; }
+  void setStatsPath(const std::string& path) { statsPath = path; }
   void run();
 };
 
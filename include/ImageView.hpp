@@ -0,0 +1,41 @@
+#ifndef __IMAGEVIEW_HPP__
+#define __IMAGEVIEW_HPP__
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Color.hpp"
+
+// Non-owning, pitch-aware view of three 8-bit planes (R, G, B). Views are
+// cheap to copy; whoever owns the pixels must outlive every view of them.
+class ImageView {
+ private:
+  int width, height;
+  size_t pitch;
+  const uint8_t* planes[3];
+
+ public:
+  ImageView()
+      : width(0), height(0), pitch(0), planes{nullptr, nullptr, nullptr} {}
+  ImageView(int width, int height, size_t pitch, const uint8_t* r,
+            const uint8_t* g, const uint8_t* b)
+      : width(width), height(height), pitch(pitch), planes{r, g, b} {}
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  size_t getPitch() const { return pitch; }
+
+  const uint8_t* row(int channel, int y) const {
+    return planes[channel] + static_cast<size_t>(y) * pitch;
+  }
+  Color getPixel(int x, int y) const {
+    return Color{row(0, y)[x], row(1, y)[x], row(2, y)[x]};
+  }
+  // The width x height block at (x, y), sharing these pixels.
+  ImageView subview(int x, int y, int width, int height) const {
+    return ImageView(width, height, pitch, row(0, y) + x, row(1, y) + x,
+                     row(2, y) + x);
+  }
+};
+
+#endif
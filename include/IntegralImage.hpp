@@ -0,0 +1,90 @@
+#ifndef __INTEGRALIMAGE_HPP__
+#define __INTEGRALIMAGE_HPP__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Color.hpp"
+#include "ImageView.hpp"
+
+// Which sums of squares the summed-area tables keep besides the channel sums:
+// none, the total over the channels, squared luma, or one per channel.
+enum class SquareSums { None, Total, Luma, PerChannel };
+
+// Per-block sums read from the summed-area tables. Luma is kept in integer
+// units of 1/1000 (299 R + 587 G + 114 B) so every term stays exact.
+struct BlockSums {
+  long long count;
+  uint64_t sum[3];        // R, G, B
+  uint64_t sumSq;         // sum of R^2 + G^2 + B^2, without Luma
+  uint64_t lumaSq;        // sum of (299 R + 587 G + 114 B)^2, with Luma
+  uint64_t channelSq[3];  // sums of R^2, G^2 and B^2, with PerChannel
+  uint64_t lumaSum() const {
+    return 299 * sum[0] + 587 * sum[1] + 114 * sum[2];
+  }
+  // Truncated towards zero like the pixel scans.
+  Color average() const {
+    if (count == 0) return Color{0, 0, 0};
+    return Color{static_cast<int>(sum[0] / count),
+                 static_cast<int>(sum[1] / count),
+                 static_cast<int>(sum[2] / count)};
+  }
+};
+
+// Summed-area tables of an image, built once so any block's channel sums (and
+// optionally sums of squares) can be read with four lookups per table. Entries
+// wrap modulo 2^32 (2^64 for squared luma), which keeps a rectangle's sums
+// exact as long as its own totals fit. Blocks too large for that are read as
+// a grid of pieces that fit, added up in 64 bits; there are few such blocks
+// and few pieces per pixel, so this costs next to nothing. The tables take 12
+// bytes per pixel, plus 4 with Total, 8 with Luma and 12 with PerChannel.
+class IntegralImage {
+ private:
+  int width, height;
+  SquareSums squares;
+  long long pieceArea;  // largest rectangle whose sums cannot wrap
+  int pieceSide;        // side of the largest such square
+  std::vector<uint32_t> sum[3];
+  std::vector<uint32_t> sumSq;
+  std::vector<uint64_t> lumaSq;
+  std::vector<uint32_t> channelSq[3];
+
+  size_t index(int x, int y) const {
+    return static_cast<size_t>(y) * (width + 1) + x;
+  }
+  template <typename T>
+  T rect(const std::vector<T>& table, int x, int y, int w, int h) const {
+    return static_cast<T>(table[index(x + w, y + h)] -
+                          table[index(x, y + h)] - table[index(x + w, y)] +
+                          table[index(x, y)]);
+  }
+  // Call visit(x, y, w, h) on each piece of a grid covering the block, whose
+  // pieces are at most area pixels and side pixels wide.
+  template <typename Visit>
+  static void forEachPiece(int x, int y, int w, int h, long long area,
+                           int side, Visit visit) {
+    if (static_cast<long long>(w) * h <= area) {
+      visit(x, y, w, h);
+      return;
+    }
+    for (int py = y; py < y + h; py += side)
+      for (int px = x; px < x + w; px += side)
+        visit(px, py, std::min(side, x + w - px), std::min(side, y + h - py));
+  }
+
+ public:
+  IntegralImage();
+  IntegralImage(const ImageView& image, SquareSums squares);
+  // Rebuild the tables for another image, reusing their memory.
+  void build(const ImageView& image, SquareSums squares);
+  SquareSums getSquareSums() const { return squares; }
+  BlockSums query(int x, int y, int w, int h) const;
+  Color average(int x, int y, int w, int h) const;
+  double variance(int x, int y, int w, int h) const;
+  static double variance(long long count, const uint64_t sum[3],
+                         uint64_t sumSq);
+};
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef __MAPPEDIMAGE_HPP__
+#define __MAPPEDIMAGE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "Image.hpp"
+#include "QuadtreeNode.hpp"
+
+// Read-only memory map of a binary PPM (P6, 8-bit) file. Pages are only read
+// in as blocks are copied out, so an image far larger than memory can be
+// processed a block at a time. Rows are addressed bottom-up like every other
+// image in the program: y = 0 is the last row of the file.
+class MappedImage {
+ private:
+  int fd;
+  uint8_t* map;
+  size_t mapSize;
+  size_t dataOffset;
+  int width, height;
+
+  const uint8_t* fileRow(int y) const {
+    return map + dataOffset +
+           static_cast<size_t>(height - 1 - y) * width * 3;
+  }
+
+ public:
+  // Throws std::runtime_error if the file cannot be mapped or is not a
+  // complete 8-bit binary PPM.
+  explicit MappedImage(const std::string& path);
+  MappedImage(const MappedImage&) = delete;
+  MappedImage& operator=(const MappedImage&) = delete;
+  ~MappedImage();
+
+  int getWidth() const { return width; }
+  int getHeight() const { return height; }
+  size_t getFileSize() const { return mapSize; }
+
+  // Copy the block's pixels into out, reallocating it only if its size
+  // differs.
+  void copyBlock(const Block& block, Image& out) const;
+  // Let the kernel drop the mapped pages under the block's rows; they are
+  // read again if touched later.
+  void release(const Block& block) const;
+};
+
+#endif
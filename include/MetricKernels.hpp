@@ -0,0 +1,41 @@
+#ifndef __METRICKERNELS_HPP__
+#define __METRICKERNELS_HPP__
+
+#include <cstdint>
+
+// Row kernels behind the scan-based metrics. Each one works on a single
+// 8-bit channel row and is implemented for SSE2, AVX2 and AVX-512BW; the
+// widest variant the CPU supports is picked at startup, with a scalar
+// fallback everywhere else.
+namespace MetricKernels {
+
+enum class Isa { Scalar, SSE2, AVX2, AVX512 };
+
+Isa detectIsa();
+Isa activeIsa();
+// Force a kernel set, e.g. to compare variants. Requests for an ISA the CPU
+// lacks fall back to the best supported one.
+void setIsa(Isa isa);
+const char* isaName(Isa isa);
+
+// Widen [lo, hi] to cover every byte of row[0, n).
+void minMaxRow(const uint8_t* row, int n, uint8_t& lo, uint8_t& hi);
+
+// Add sum(|row[i] - k|) to sad and the number of bytes greater than k to
+// above.
+void absDiffRow(const uint8_t* row, int n, uint8_t k, uint64_t& sad,
+                uint64_t& above);
+
+// Count row bytes into four interleaved 256-bin histograms (hist[4 * 256]),
+// rotating between them so repeated values do not stall on the same counter.
+void histogramRow(const uint8_t* row, int n, uint32_t* hist);
+
+// Shannon entropy in bits of a 256-bin histogram holding count samples.
+double entropy(const uint32_t* hist, long long count);
+double entropy(const uint64_t* hist, long long count);
+// The same sum over only the nonzero bins, given in ascending bin order.
+double entropyOfBins(const uint32_t* bins, int n, long long count);
+
+}  // namespace MetricKernels
+
+#endif
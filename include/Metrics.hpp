@@ -3,48 +3,148 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <type_traits>
 #include <vector>
 
 #include "Color.hpp"
+#include "ImageView.hpp"
+#include "IntegralImage.hpp"
+
+// Everything a metric needs to score a block without reading its pixels:
+// channel sums, squares, ranges and, when asked for, channel histograms.
+// The summaries of a block's quadrants add up to its own, which lets blocks
+// too large to hold in memory be scored from their parts.
+struct BlockSummary {
+  long long count = 0;
+  uint64_t sum[3] = {0, 0, 0};
+  uint64_t sumSq[3] = {0, 0, 0};  // sums of R^2, G^2 and B^2
+  unsigned __int128 lumaSq = 0;   // as in BlockSums, but wide enough for
+                                  // gigapixel blocks
+  uint8_t lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+  std::vector<uint64_t> histogram;  // 3 x 256 bins, or empty
+
+  static BlockSummary of(const ImageView& image, bool withHistogram);
+  void add(const BlockSummary& other);
+  Color average() const;
+};
 
 class Metric {
+ protected:
+  const IntegralImage* integral = nullptr;
+
  public:
-  virtual double compute(const std::vector<std::vector<Color>>& pixels, int x,
-                         int y, int width, int height) = 0;
+  virtual double compute(const ImageView& image, int x, int y, int width,
+                         int height) = 0;
+  // Score a block from its summary. Gives the same value as compute() on
+  // the block's pixels.
+  virtual double compute(const BlockSummary& summary) = 0;
+  // Whether the block's error, rounded to float as the build stores it, is
+  // at least threshold. Metrics that scan pixels may stop as soon as the
+  // answer is certain: error then receives a lower bound that still passes
+  // the same test, and otherwise the exact value.
+  virtual bool exceeds(const ImageView& image, int x, int y, int width,
+                       int height, double threshold, double& error) {
+    error = compute(image, x, y, width, height);
+    return static_cast<float>(error) >= threshold;
+  }
+  virtual bool needsHistogram() const { return false; }
+  // Metrics that can be answered from block sums read them from the image's
+  // summed-area tables instead of rescanning the block.
+  void setIntegralImage(const IntegralImage* table) { integral = table; }
+  virtual SquareSums squareSums() const { return SquareSums::None; }
   virtual ~Metric() {}
 };
 
-class VarianceMetric : public Metric {
+class VarianceMetric final : public Metric {
  public:
-  double compute(const std::vector<std::vector<Color>>& pixels, int x, int y,
-                 int width, int height) override;
+  double compute(const ImageView& image, int x, int y, int width,
+                 int height) override;
+  double compute(const BlockSummary& summary) override;
+  double compute(const BlockSums& sums) const;
+  SquareSums squareSums() const override { return SquareSums::Total; }
 };
 
-class MADMetric : public Metric {
+class MADMetric final : public Metric {
+ private:
+  void channelSums(const ImageView& image, int x, int y, int width,
+                   int height, uint64_t sums[3]) const;
+
  public:
-  double compute(const std::vector<std::vector<Color>>& pixels, int x, int y,
-                 int width, int height) override;
+  double compute(const ImageView& image, int x, int y, int width,
+                 int height) override;
+  double compute(const BlockSummary& summary) override;
+  bool exceeds(const ImageView& image, int x, int y, int width, int height,
+               double threshold, double& error) override;
+  bool needsHistogram() const override { return true; }
 };
 
-class MaxPixelDifferenceMetric : public Metric {
+class MaxPixelDifferenceMetric final : public Metric {
  public:
-  double compute(const std::vector<std::vector<Color>>& pixels, int x, int y,
-                 int width, int height) override;
+  double compute(const ImageView& image, int x, int y, int width,
+                 int height) override;
+  double compute(const BlockSummary& summary) override;
+  bool exceeds(const ImageView& image, int x, int y, int width, int height,
+               double threshold, double& error) override;
 };
 
-class EntropyMetric : public Metric {
+class EntropyMetric final : public Metric {
  public:
-  double compute(const std::vector<std::vector<Color>>& pixels, int x, int y,
-                 int width, int height) override;
+  double compute(const ImageView& image, int x, int y, int width,
+                 int height) override;
+  double compute(const BlockSummary& summary) override;
+  bool needsHistogram() const override { return true; }
 };
 
-class SSIMetric : public Metric {
-  private:
-   double threshold;
-  public:
-  SSIMetric(double threshold);
-  double compute(const std::vector<std::vector<Color>>& pixels, int x, int y,
-                 int width, int height) override;
+// Structural similarity between a block and its flat reconstruction, the
+// block's average color. The reconstruction has no variance of its own and
+// no covariance with the block, so SSIM reduces to its luminance and
+// contrast terms, and both come from block sums. It is compared on luma, or
+// on each channel and averaged. The error is 1 - SSIM.
+class SSIMetric final : public Metric {
+ private:
+  bool perChannel;
+  double fromSums(long long count, const uint64_t sum[3],
+                  const uint64_t channelSq[3],
+                  unsigned __int128 lumaSq) const;
+
+ public:
+  explicit SSIMetric(bool perChannel = false);
+  double compute(const ImageView& image, int x, int y, int width,
+                 int height) override;
+  double compute(const BlockSummary& summary) override;
+  double compute(const BlockSums& sums) const;
+  SquareSums squareSums() const override {
+    return perChannel ? SquareSums::PerChannel : SquareSums::Luma;
+  }
 };
 
+// Metrics scored from block sums alone. A build with summed-area tables
+// reads their error and average color from a single query.
+template <typename M>
+struct ReadsBlockSums : std::false_type {};
+template <>
+struct ReadsBlockSums<VarianceMetric> : std::true_type {};
+template <>
+struct ReadsBlockSums<SSIMetric> : std::true_type {};
+
+// Call fn once with the metric as its concrete built-in type, so templated
+// code calls it directly instead of through the vtable. Any other Metric is
+// passed as a plain Metric&.
+template <typename Fn>
+void withMetricType(Metric& metric, Fn&& fn) {
+  if (auto* m = dynamic_cast<VarianceMetric*>(&metric))
+    fn(*m);
+  else if (auto* m = dynamic_cast<MADMetric*>(&metric))
+    fn(*m);
+  else if (auto* m = dynamic_cast<MaxPixelDifferenceMetric*>(&metric))
+    fn(*m);
+  else if (auto* m = dynamic_cast<EntropyMetric*>(&metric))
+    fn(*m);
+  else if (auto* m = dynamic_cast<SSIMetric*>(&metric))
+    fn(*m);
+  else
+    fn(metric);
+}
+
 #endif
@@ -0,0 +1,45 @@
+#ifndef __NODEARENA_HPP__
+#define __NODEARENA_HPP__
+
+#include <cstdint>
+#include <vector>
+
+#include "QuadtreeNode.hpp"
+
+// Contiguous node storage for one tree. Nodes are addressed by 32-bit index,
+// children are allocated four at a time, and the whole tree is released with
+// a single deallocation. clear() keeps the capacity for the next build.
+class NodeArena {
+ private:
+  std::vector<QuadtreeNode> nodes;
+
+ public:
+  uint32_t allocate(uint32_t count) {
+    uint32_t first = static_cast<uint32_t>(nodes.size());
+    nodes.resize(nodes.size() + count);
+    return first;
+  }
+  QuadtreeNode& operator[](uint32_t index) { return nodes[index]; }
+  const QuadtreeNode& operator[](uint32_t index) const { return nodes[index]; }
+  size_t size() const { return nodes.size(); }
+  size_t bytes() const { return nodes.capacity() * sizeof(QuadtreeNode); }
+  void reserve(size_t count) { nodes.reserve(count); }
+  void clear() { nodes.clear(); }
+  // Drop every node from index first on, e.g. a subtree that was built and
+  // then not kept. Capacity is kept.
+  void truncate(uint32_t first) { nodes.resize(first); }
+
+  // Move a subtree built in another arena (root at index 0) into the given
+  // slot, appending its descendants and rebasing their child indices. The
+  // layout is the same as if the subtree had been built here directly.
+  void splice(uint32_t slot, const NodeArena& subtree) {
+    uint32_t offset = static_cast<uint32_t>(nodes.size()) - 1;
+    nodes[slot] = subtree.nodes[0];
+    if (nodes[slot].hasChildren()) nodes[slot].firstChild += offset;
+    nodes.insert(nodes.end(), subtree.nodes.begin() + 1, subtree.nodes.end());
+    for (size_t i = offset + 1; i < nodes.size(); i++)
+      if (nodes[i].hasChildren()) nodes[i].firstChild += offset;
+  }
+};
+
+#endif
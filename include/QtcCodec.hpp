@@ -0,0 +1,94 @@
+#ifndef __QTCCODEC_HPP__
+#define __QTCCODEC_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Color.hpp"
+#include "Rasterizer.hpp"
+
+class Quadtree;
+
+struct QtcHeader {
+  int width, height;
+  int minBlockSize;
+};
+
+// Native quadtree bitstream (.qtc). After a fixed header and two Huffman
+// tables, the nodes follow in depth-first order. Each node stores its color
+// as a difference from its parent's color (the root's from mid-grey), and
+// every node that could split also stores a one-bit split flag. Green
+// differences use one table. Red and blue are coded relative to the green
+// difference with the other table. The tables are canonical, so only code
+// lengths are stored.
+//
+//   "QTC1" | width u32 | height u32 | minBlockSize u32 |
+//   code lengths: 2 x 256 x 4 bits | node bits, MSB first
+class QtcCodec {
+ public:
+  static const int kMaxCodeLength = 12;
+  // Largest image a stream may declare. A handful of node bits can cover
+  // any area, so the payload size does not bound the bitmap a decoder has
+  // to allocate; this does (768 MiB at 24 bits).
+  static const int64_t kMaxPixels = int64_t(1) << 28;
+
+  // Serialise the visible tree: nodes removed by pruning are stored as
+  // leaves.
+  static std::vector<uint8_t> encode(const Quadtree& tree);
+  // Append the stream to out, so a caller encoding many trees can reuse one
+  // buffer.
+  static void encode(const Quadtree& tree, std::vector<uint8_t>& out);
+  // Returns false if the data does not start with a valid header, the image
+  // is larger than kMaxPixels, or no node data follows the header.
+  static bool readHeader(const uint8_t* data, size_t size, QtcHeader& header);
+  // Decode straight into target, which must be at least as large as the
+  // image, painting each leaf as soon as it is read. No tree is built.
+  // Throws std::runtime_error on malformed input.
+  static void decode(const uint8_t* data, size_t size,
+                     const PixelBuffer& target);
+
+  static bool isQtcPath(const std::string& path);
+};
+
+// Symbol counts of part of a node stream. Counts of separate subtrees add up,
+// so a stream too large to hold can be counted piece by piece before its
+// Huffman tables are built.
+struct QtcSymbolCounts {
+  std::vector<uint64_t> green, chroma;
+
+  QtcSymbolCounts();
+  void addNode(const Color& parent, const Color& color);
+  // Every visible node below the tree's root. The root's own symbols depend
+  // on its parent, which callers add with addNode.
+  void addDescendants(const Quadtree& tree);
+  void add(const QtcSymbolCounts& other);
+};
+
+// Writes a .qtc stream node by node. The tables are fixed by the counts
+// given up front, so the nodes written afterwards, in depth-first order,
+// must be exactly the ones counted. Bytes are appended to out, which the
+// caller may drain between calls.
+class QtcEncoder {
+ private:
+  std::vector<uint8_t> greenLengths, chromaLengths;
+  std::vector<uint32_t> greenCodes, chromaCodes;
+  std::vector<uint8_t>& out;
+  uint64_t buffer;
+  int bits;
+
+  void writeBits(uint32_t value, int count);
+
+ public:
+  QtcEncoder(const QtcHeader& header, const QtcSymbolCounts& counts,
+             std::vector<uint8_t>& out);
+  // split is -1 for blocks too small to split, which store no flag.
+  void writeNode(const Color& parent, const Color& color, int split);
+  // The whole visible tree, root first.
+  void writeTree(const Quadtree& tree, const Color& parent);
+  // Pad the last byte.
+  void finish();
+};
+
+#endif
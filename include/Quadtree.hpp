@@ -3,36 +3,124 @@
 
 #include <FreeImage.h>
 
+#include <algorithm>
 #include <cmath>
-#include <functional>
 #include <iostream>
 #include <vector>
 
 #include "Color.hpp"
+#include "ImageView.hpp"
+#include "IntegralImage.hpp"
 #include "Metrics.hpp"
+#include "NodeArena.hpp"
 #include "QuadtreeNode.hpp"
+#include "Stats.hpp"
+#include "ThreadPool.hpp"
+
+// TopDown scores a block only when its parent splits, reading each block's
+// statistics from summed-area tables or by scanning its pixels. BottomUp
+// scans every pixel once, at the smallest blocks, and merges their
+// BlockSummary four to one up the tree; it needs no summed-area tables and
+// does the same work whatever the threshold. BestFirst keeps splitting the
+// leaf with the largest error times area until one of the budgets below
+// runs out, so the size of the tree and the time spent on it are bounded
+// whatever the image; without budgets it builds the TopDown tree.
+enum class BuildEngine { TopDown, BottomUp, BestFirst };
+
+// How the tree is built. With more than one thread, blocks of at least
+// parallelCutoff pixels hand their children to a work-stealing pool; smaller
+// blocks are built serially on whichever thread reached them. The tree is
+// the same for every setting. The best-first engine is serial and stops at
+// the first budget reached; 0 leaves a budget unlimited.
+// A caller building many trees lends one pool instead of starting threads
+// per build; the tree also paints and animates on it, so the pool must
+// outlive the tree. Without one, a build starts its own pool only if the
+// root is at least parallelCutoff pixels.
+// Unless exactErrors is set, the top-down engine only asks the metric
+// whether a block exceeds the threshold, which lets scanning metrics stop
+// early; a split node then keeps a lower bound of its error. The tree is
+// the same, but prune(), getSplitErrors() and DetailLevel::maxError need
+// exact errors.
+struct BuildOptions {
+  int threadCount = 1;
+  long long parallelCutoff = 256 * 256;
+  BuildEngine engine = BuildEngine::TopDown;
+  bool exactErrors = false;
+  long long maxLeaves = 0;
+  long long maxBytes = 0;  // node storage, sizeof(QuadtreeNode) per node
+  double maxSeconds = 0;   // spent splitting, after the summed-area tables
+  ThreadPool* pool = nullptr;  // borrowed, used with threadCount > 1
+};
+
+// Memory a long-running caller lends to one build after another, so the
+// node arena and the summed-area tables keep their capacity between images
+// instead of being allocated for each. The tables come back when the build
+// finishes, but a tree holds the arena until it is destroyed, so one storage
+// serves one tree at a time.
+struct TreeStorage {
+  NodeArena nodes;
+  IntegralImage integral;
+};
+
+// Visible nodes at one depth of the tree, and how many of them are leaves.
+struct LevelCount {
+  long long nodes, leaves;
+};
 
 class Quadtree {
  private:
-  std::vector<std::vector<Color>> pixelData;
-  QuadtreeNode* root;
+  ImageView pixelData;
+  IntegralImage integral;
+  NodeArena nodes;
   double threshold;
   int minBlockSize;
   Metric* metric;
-  QuadtreeNode* buildQuadtree(int x, int y, int width, int height,
-                              int depth = 0);
-  Color calculateAverageColor(const std::vector<std::vector<Color>>& data,
-                              int x, int y, int width, int height);
+  BuildOptions options;
+  ThreadPool* pool;
+  TreeStorage* storage;
+  BuildCounters counters;
+  std::vector<LevelCount> levels;  // visible nodes per depth
+  long long nodeCount, leafCount;
+  // The engines are instantiated per built-in metric type, see
+  // withMetricType.
+  template <typename M>
+  float scoreBlock(M& metric, QuadtreeNode& node, const Block& block,
+                   bool exact);
+  template <typename M>
+  void buildQuadtree(M& metric, NodeArena& arena, uint32_t index,
+                     const Block& block, std::vector<LevelCount>& levels);
+  template <typename M>
+  BlockSummary buildBottomUp(M& metric, NodeArena& arena, uint32_t index,
+                             const Block& block);
+  template <typename M>
+  void buildBestFirst(M& metric);
+  void setLevels(const std::vector<LevelCount>& counted);
+  void countLevels();
+  Color calculateAverageColor(int x, int y, int width, int height) const;
 
  public:
-  Quadtree(const std::vector<std::vector<Color>>& data, double thresh,
-           Metric* metric, int minBlockSize);
+  Quadtree(const ImageView& data, double thresh, Metric* metric,
+           int minBlockSize, const BuildOptions& options = BuildOptions(),
+           TreeStorage* storage = nullptr);
+  Quadtree(const Quadtree&) = delete;
+  Quadtree& operator=(const Quadtree&) = delete;
   ~Quadtree();
-  int getTreeDepth() const;
-  int getNodeCount() const;
-  int getLeafCount() const;
-  FIBITMAP* createImage(int customDepth, bool showLines);
-  QuadtreeNode* getRoot() const { return root; }
+  // Shape of the visible tree, kept up to date by the build and prune().
+  int getTreeDepth() const { return static_cast<int>(levels.size()); }
+  long long getNodeCount() const { return nodeCount; }
+  long long getLeafCount() const { return leafCount; }
+  const std::vector<LevelCount>& getLevelCounts() const { return levels; }
+  const BuildCounters& getBuildCounters() const { return counters; }
+  void prune(double threshold);
+  std::vector<float> getSplitErrors() const;
+  FIBITMAP* createImage(int customDepth, bool showLines, int threadCount = 1);
+  const NodeArena& getNodes() const { return nodes; }
+  const QuadtreeNode& getRoot() const { return nodes[0]; }
+  int getMinBlockSize() const { return minBlockSize; }
+  const BuildOptions& getBuildOptions() const { return options; }
+  Block getRootBlock() const {
+    return Block{0, 0, pixelData.getWidth(), pixelData.getHeight(), 0};
+  }
 };
 
 #endif
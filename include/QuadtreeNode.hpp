@@ -1,17 +1,51 @@
 #ifndef __QUADTREE_NODE_HPP__
 #define __QUADTREE_NODE_HPP__
 
+#include <cstdint>
+
 #include "Color.hpp"
 
+// Rectangle covered by a node. It is never stored: the root covers the whole
+// image and every child is derived from its parent while walking the tree.
+struct Block {
+  int x, y, width, height, depth;
+
+  // Quadrants in the order top-left, top-right, bottom-left, bottom-right;
+  // odd sizes give the extra row or column to the right and bottom halves.
+  Block child(int i) const;
+  bool canSplit(int minBlockSize) const {
+    return static_cast<long long>(width / 2) * (height / 2) >= minBlockSize;
+  }
+  long long area() const { return static_cast<long long>(width) * height; }
+};
+
+// Compact 12-byte node. The four children of a node are stored next to each
+// other in the tree's NodeArena, so one index reaches all of them; index 0 is
+// the root, which is never a child, and doubles as "no children".
 class QuadtreeNode {
+ private:
+  static const uint8_t kLeaf = 1;
+
  public:
-  int x, y, width, height, depth;
-  bool isLeaf;
-  Color color;
-  QuadtreeNode* children[4];
+  uint32_t firstChild;
+  float error;  // metric value of the block, kept for re-pruning
+  uint8_t r, g, b;
+  uint8_t flags;
+
+  QuadtreeNode() : firstChild(0), error(0), r(0), g(0), b(0), flags(kLeaf) {}
 
-  QuadtreeNode(int _x, int _y, int _width, int _height);
-  ~QuadtreeNode();
+  bool hasChildren() const { return firstChild != 0; }
+  // A node with children can still act as a leaf after pruning.
+  bool isLeaf() const { return flags & kLeaf; }
+  void setLeaf(bool leaf) {
+    flags = leaf ? (flags | kLeaf) : (flags & ~kLeaf);
+  }
+  Color getColor() const { return Color{r, g, b}; }
+  void setColor(const Color& color) {
+    r = color.r;
+    g = color.g;
+    b = color.b;
+  }
 };
 
 #endif
@@ -0,0 +1,81 @@
+#ifndef __QUADTREEQUERY_HPP__
+#define __QUADTREEQUERY_HPP__
+
+#include <climits>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "Color.hpp"
+#include "Quadtree.hpp"
+#include "QuadtreeNode.hpp"
+#include "Rasterizer.hpp"
+
+// How much of the tree a query sees. Besides the tree's own leaves, nodes at
+// maxDepth and nodes whose error is below maxError act as leaves, so one
+// tree built with a low threshold answers every coarser level of detail. A
+// level can only coarsen the tree as it is currently pruned, and maxError
+// needs a tree built with exact errors.
+struct DetailLevel {
+  int maxDepth = INT_MAX;
+  double maxError = -std::numeric_limits<double>::infinity();
+
+  bool stopsAt(const QuadtreeNode& node, int depth) const {
+    return node.isLeaf() || depth >= maxDepth || node.error < maxError;
+  }
+};
+
+// Read-only queries over a built quadtree: the color at a point, the leaves
+// over a rectangle and renders at any level of detail and output size. A
+// query keeps no state between calls, so any number of threads can query
+// the same tree at once as long as none of them prunes it.
+class QuadtreeQuery {
+ private:
+  const Quadtree& tree;
+
+ public:
+  explicit QuadtreeQuery(const Quadtree& tree) : tree(tree) {}
+
+  // Color of the leaf over pixel (x, y), found in O(depth) steps. Points
+  // outside the image are black.
+  Color colorAt(int x, int y, const DetailLevel& level = DetailLevel()) const;
+
+  // Call fn(block, node) for every leaf whose block overlaps the rectangle,
+  // in depth-first order. Subtrees outside the rectangle are never visited.
+  template <typename Fn>
+  void forEachLeaf(int x, int y, int width, int height, Fn fn,
+                   const DetailLevel& level = DetailLevel()) const;
+
+  // Paint the image scaled to the target's size. Each output pixel takes
+  // the color of the node covering it whose block shrinks to at most one
+  // output pixel, which is that block's average, so a downscaled render
+  // visits a number of nodes proportional to the output size.
+  void render(const PixelBuffer& target,
+              const DetailLevel& level = DetailLevel()) const;
+};
+
+template <typename Fn>
+void QuadtreeQuery::forEachLeaf(int x, int y, int width, int height, Fn fn,
+                                const DetailLevel& level) const {
+  const NodeArena& nodes = tree.getNodes();
+  std::vector<std::pair<uint32_t, Block>> stack;
+  stack.emplace_back(0, tree.getRootBlock());
+  while (!stack.empty()) {
+    uint32_t index = stack.back().first;
+    Block block = stack.back().second;
+    stack.pop_back();
+    if (block.x >= x + width || block.x + block.width <= x ||
+        block.y >= y + height || block.y + block.height <= y)
+      continue;
+    const QuadtreeNode& node = nodes[index];
+    if (level.stopsAt(node, block.depth)) {
+      fn(block, node);
+      continue;
+    }
+    for (int i = 3; i >= 0; i--)
+      stack.emplace_back(node.firstChild + i, block.child(i));
+  }
+}
+
+#endif
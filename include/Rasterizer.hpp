@@ -0,0 +1,59 @@
+#ifndef __RASTERIZER_HPP__
+#define __RASTERIZER_HPP__
+
+#include <FreeImage.h>
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+
+#include "NodeArena.hpp"
+#include "QuadtreeNode.hpp"
+
+class Quadtree;
+class ThreadPool;
+
+// Writable 24- or 32-bit pixels in FreeImage byte order (FI_RGBA_*), rows
+// bottom-up like FreeImage bitmaps.
+struct PixelBuffer {
+  uint8_t* bits;
+  size_t pitch;
+  int width, height;
+  int bytesPerPixel;
+
+  static PixelBuffer fromBitmap(FIBITMAP* bitmap);
+  uint8_t* pixel(int x, int y) const {
+    return bits + static_cast<size_t>(y) * pitch +
+           static_cast<size_t>(x) * bytesPerPixel;
+  }
+};
+
+struct RasterOptions {
+  int maxDepth = INT_MAX;  // nodes at this depth are painted as leaves
+  bool outline = false;    // draw a black border around every painted block
+  int threadCount = 1;
+  ThreadPool* pool = nullptr;  // borrowed; null starts one when needed
+};
+
+// Paints the leaves of a quadtree straight into bitmap memory: the first row
+// of a block is filled by doubling copies of one pixel and the other rows are
+// copies of the first, so the cost is bounded by memory bandwidth rather than
+// one call per pixel. With several threads the tree is cut into subtrees,
+// which cover disjoint pixels and are painted in parallel; the result is
+// the same as a serial paint.
+class Rasterizer {
+ private:
+  static void paintSubtree(const NodeArena& nodes, uint32_t root,
+                           const Block& rootBlock, const PixelBuffer& target,
+                           const RasterOptions& options);
+
+ public:
+  static void paint(const Quadtree& tree, const PixelBuffer& target,
+                    const RasterOptions& options = RasterOptions());
+  static void fillRect(const PixelBuffer& target, int x, int y, int width,
+                       int height, uint8_t r, uint8_t g, uint8_t b);
+  static void outlineRect(const PixelBuffer& target, int x, int y, int width,
+                          int height);
+};
+
+#endif
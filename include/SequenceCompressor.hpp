@@ -0,0 +1,76 @@
+#ifndef __SEQUENCECOMPRESSOR_HPP__
+#define __SEQUENCECOMPRESSOR_HPP__
+
+#include <FreeImage.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Image.hpp"
+#include "Metrics.hpp"
+#include "Quadtree.hpp"
+#include "Rasterizer.hpp"
+#include "Stats.hpp"
+
+// Compresses the frames of a sequence of same-size images, such as camera or
+// screen captures, where consecutive frames differ in few places. The tree
+// is cut along its own blocks into tiles at most tileSize pixels on a side,
+// as in TiledCompressor, and the blocks above the tiles are scored from the
+// merged summaries of their quadrants. Each frame is compared with the last
+// tile by tile: only the tiles whose pixels changed are summarised again,
+// only their ancestors are rescored, and only the blocks whose visible
+// color changed are repainted into the kept rendering of the last frame.
+// Apart from decoding, comparing and saving the frame, the work per frame
+// follows the amount of change, and every frame is rendered exactly as a
+// full build of it would be.
+class SequenceCompressor {
+ private:
+  // A block of the tree down to the tiles, in preorder. What was last
+  // painted is kept to find the blocks whose rendering changed.
+  struct Slot {
+    Block block;
+    int children[4];  // slots of the quadrants, or -1 in a tile
+    BlockSummary summary;
+    Color color;
+    bool split;
+    bool dirty;  // the block's pixels changed in this frame
+    Color paintedColor;
+    bool paintedSplit;
+    std::unique_ptr<Quadtree> tree;  // tiles only, built when painted
+  };
+
+  double threshold;
+  int minBlockSize;
+  int tileSize;
+  BuildOptions buildOptions;
+  std::unique_ptr<Metric> metric;
+  Image frame;  // pixels of the last frame
+  FIBITMAP* bitmap;  // its rendering
+  std::vector<uint8_t> encoded;  // its JPEG, kept to reuse the buffer
+  std::vector<Slot> slots;
+  long long frameCount;
+
+  bool isTile(const Block& block) const;
+  int addSlot(const Block& block);
+  bool tileChanged(const Slot& slot, const Image& next) const;
+  void copyTile(const Slot& slot, const Image& next);
+  long long paint(int index, bool force, const PixelBuffer& target);
+
+ public:
+  SequenceCompressor(int errorMethod, double threshold, int minBlockSize,
+                     int tileSize = 64,
+                     const BuildOptions& options = BuildOptions());
+  SequenceCompressor(const SequenceCompressor&) = delete;
+  SequenceCompressor& operator=(const SequenceCompressor&) = delete;
+  ~SequenceCompressor();
+
+  // Compress the next frame and save its rendering to outputPath as JPEG,
+  // returning the sizes of the frame read and the JPEG written. Throws
+  // std::runtime_error if the frame cannot be read, differs in size from the
+  // first frame, or cannot be saved.
+  ByteCounts compress(const std::string& inputPath,
+                      const std::string& outputPath, RunStats& stats);
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef __STATS_HPP__
+#define __STATS_HPP__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+class Quadtree;
+
+// Counters bumped on the build's hot path. They only change when the program
+// is compiled with -DQUADTREE_STATS (make STATS=1); otherwise QUADTREE_COUNT
+// expands to nothing and the counters stay at zero.
+struct BuildCounters {
+  std::atomic<long long> metricEvaluations{0};
+  std::atomic<long long> pixelsTouched{0};  // total area of evaluated blocks
+};
+
+#ifdef QUADTREE_STATS
+#define QUADTREE_COUNT(counter, amount) \
+  (counter).fetch_add((amount), std::memory_order_relaxed)
+#else
+#define QUADTREE_COUNT(counter, amount) ((void)0)
+#endif
+
+// Exact sizes of a compression's input and output, taken from the bytes read
+// and written rather than from the files afterwards.
+struct ByteCounts {
+  long long input = 0;
+  long long output = 0;
+};
+
+// Phase timings and tree statistics for one compressed image, exported as a
+// JSON object. The peak RSS recorded with each phase belongs to the whole
+// process, so it is left out when other images are compressed alongside.
+class RunStats {
+ private:
+  struct Phase {
+    std::string name;
+    double seconds;
+    long peakRssKb;
+  };
+  std::vector<std::pair<std::string, std::string>> fields;  // JSON values
+  std::vector<Phase> phases;
+  bool recordPeakRss;
+
+ public:
+  explicit RunStats(bool recordPeakRss = true)
+      : recordPeakRss(recordPeakRss) {}
+
+  static bool countersEnabled();
+  static long peakRssKb();
+
+  void set(const std::string& key, const std::string& value);
+  void set(const std::string& key, double value);
+  // Record a finished phase, along with the process's peak RSS so far if
+  // it is recorded.
+  void addPhase(const std::string& name, double seconds);
+  // Depth, node and leaf counts per level, arena size and build counters.
+  void addTree(const Quadtree& tree);
+  std::string toJson() const;
+};
+
+// Times the enclosing scope as one phase of a RunStats.
+class ScopedPhase {
+ private:
+  RunStats& stats;
+  std::string name;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  ScopedPhase(RunStats& stats, const std::string& name)
+      : stats(stats), name(name), start(std::chrono::steady_clock::now()) {}
+  ~ScopedPhase() {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    stats.addPhase(name, elapsed.count());
+  }
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __THREADPOOL_HPP__
+#define __THREADPOOL_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size work-stealing thread pool. Every worker owns a deque: it pushes
+// and pops its own tasks at the back (LIFO, cache friendly for recursive
+// work) and steals from the front of the other deques when it runs dry.
+// Tasks submitted from outside the pool go to a shared injection queue.
+class ThreadPool {
+ public:
+  using Task = std::function<void()>;
+
+  explicit ThreadPool(int threadCount);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  int size() const { return static_cast<int>(workers.size()); }
+  void submit(Task task);
+  // Run one queued task on the calling thread. Returns false if none was
+  // found, which lets waiting threads help instead of blocking.
+  bool runPendingTask();
+  // Run queued tasks on the calling thread until done() holds, sleeping
+  // while none is queued. Whatever makes done() true must then call
+  // notifyWaiters().
+  void waitUntil(const std::function<bool()>& done);
+  void notifyWaiters();
+  // Index of the calling worker in this pool, or -1 for any other thread.
+  int currentWorker() const;
+
+ private:
+  struct WorkQueue {
+    std::mutex lock;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkQueue>> queues;  // workers, then injection
+  std::vector<std::thread> workers;
+  std::mutex sleepLock;
+  std::condition_variable wake;
+  std::condition_variable progress;  // wakes threads in waitUntil
+  int waiting;                       // threads asleep in waitUntil
+  std::atomic<int> queued;
+  bool stopping;
+
+  bool popTask(int self, Task& task);
+  void workerLoop(int index);
+};
+
+// A set of tasks whose completion can be awaited. wait() executes queued
+// tasks while it waits, so nested groups never deadlock the pool, and sleeps
+// once none is queued until the group's last task finishes or more work
+// arrives. The first exception thrown by a task is rethrown from wait().
+class TaskGroup {
+ private:
+  ThreadPool& pool;
+  std::atomic<int> pending;
+  std::mutex errorLock;
+  std::exception_ptr error;
+
+ public:
+  explicit TaskGroup(ThreadPool& pool) : pool(pool), pending(0) {}
+  ~TaskGroup();
+  void run(ThreadPool::Task task);
+  void wait();
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __TILEDCOMPRESSOR_HPP__
+#define __TILEDCOMPRESSOR_HPP__
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Image.hpp"
+#include "MappedImage.hpp"
+#include "Metrics.hpp"
+#include "QtcCodec.hpp"
+#include "Quadtree.hpp"
+#include "Stats.hpp"
+
+// Compresses a binary PPM of any size into a .qtc file with bounded memory.
+// The image is cut along the quadtree's own blocks into tiles at most
+// tileSize pixels on a side. The first pass builds each tile's tree, keeps
+// only a summary of its pixels and the symbol counts of its nodes, and
+// scores the blocks above the tiles from the summaries of their quadrants.
+// The second pass rebuilds the tiles that are still visible and streams
+// their nodes to the file. Memory use depends on the tile size, not on the
+// image size, and the output is byte for byte what an in-memory build
+// would write.
+class TiledCompressor {
+ private:
+  // A block above the tiles, as decided by the first pass.
+  struct UpperNode {
+    Color color;
+    bool split;
+  };
+  // What the first pass keeps of a finished block.
+  struct Scanned {
+    BlockSummary summary;
+    Color color;
+    bool split;
+    QtcSymbolCounts counts;  // every visible node below the block
+  };
+
+  double threshold;
+  int minBlockSize;
+  int tileSize;
+  BuildOptions buildOptions;
+  std::unique_ptr<Metric> metric;
+  const MappedImage* source;
+  Image tile;
+  std::vector<UpperNode> upper;  // in preorder
+  long long tileCount;
+
+  bool isTile(const Block& block) const;
+  std::unique_ptr<Quadtree> buildTile(const Block& block);
+  Scanned scan(const Block& block);
+  void skip(const Block& block, size_t& next) const;
+  void emit(const Block& block, const Color& parent, size_t& next,
+            QtcEncoder& encoder, std::vector<uint8_t>& buffer,
+            std::ostream& file);
+
+ public:
+  TiledCompressor(int errorMethod, double threshold, int minBlockSize,
+                  int tileSize, const BuildOptions& options = BuildOptions());
+
+  // Returns the sizes of the input and of the stream written. Throws
+  // std::runtime_error if the input cannot be read or the output cannot be
+  // written.
+  ByteCounts compress(const std::string& inputPath,
+                      const std::string& outputPath, RunStats& stats);
+};
+
+#endif
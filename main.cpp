@@ -1,29 +1,207 @@
-#include <sys/resource.h>
-
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <vector>
 
+#include "BatchPipeline.hpp"
+#include "CompressionServer.hpp"
 #include "ImageCompressor.hpp"
 
-/* Increase stack size to avoid depth recursion limit exceeded
- */
-void increaseStackSize() {
-  const rlim_t kStackSize = 128 * 1024 * 1024;  // 128 MB Stack
-  struct rlimit rl;
-  if (getrlimit(RLIMIT_STACK, &rl) == 0) {
-    if (rl.rlim_cur < kStackSize) {
-      rl.rlim_cur = kStackSize;
-      if (setrlimit(RLIMIT_STACK, &rl) != 0) {
-        std::cerr << "Error: Unable to increase stack size." << std::endl;
-      }
+void printUsage(const char* program) {
+  std::cerr
+      << "Usage: " << program
+      << " [--threads N] [--parallel-cutoff PIXELS] [--engine E]"
+      << " [--stats FILE]\n"
+      << "       " << program
+      << " [options] --output DIR (INPUT | DIR | --list FILE)...\n"
+      << "       " << program << " [options] (--serve | --socket PATH)\n"
+      << "\n"
+      << "Without inputs the image and settings are asked for interactively.\n"
+      << "With inputs every image is compressed into DIR. Output paths\n"
+      << "ending in .qtc use the native quadtree format instead of JPEG.\n"
+      << "As a server, requests \"<metric> <threshold> <min-block> jpg|qtc\n"
+      << "<bytes>\\n\" followed by the image are answered with \"ok <bytes>\\n\"\n"
+      << "and the output, or \"error <message>\\n\".\n"
+      << "\n"
+      << "  -m, --metric N          1: Variance, 2: MAD, 3: Max Pixel "
+         "Difference,\n"
+      << "                          4: Entropy, 5: SSIM, 6: SSIM per channel\n"
+      << "                          (default 1)\n"
+      << "  -t, --threshold X       split threshold (default 10)\n"
+      << "  -b, --min-block N       minimum block size (default 4)\n"
+      << "  --target R              target compression in (0, 1]\n"
+      << "  -o, --output DIR        output directory\n"
+      << "  --format jpg|qtc        output format (default jpg)\n"
+      << "  --gif                   also write DIR/<name>.gif\n"
+      << "  --list FILE             read input paths from FILE (- for stdin)\n"
+      << "  --decode-workers N      decoder threads (default 2)\n"
+      << "  --build-workers N       quadtree builders (default 2, 0: one per\n"
+      << "                          core)\n"
+      << "  --raster-workers N      rasterizer threads (default 1)\n"
+      << "  --encode-workers N      encoder threads (default 2)\n"
+      << "  --queue-depth N         images waiting between stages (default 4)\n"
+      << "  --tile N                compress PPM inputs out of core in tiles\n"
+      << "                          of N pixels a side (.qtc output)\n"
+      << "  --sequence N            treat the inputs as frames of a sequence\n"
+      << "                          and rebuild only the N-pixel tiles that\n"
+      << "                          changed since the last frame (jpg output)\n"
+      << "  --serve                 answer compression requests on stdin\n"
+      << "  --socket PATH           answer compression requests on a Unix\n"
+      << "                          socket (workers: --build-workers)\n"
+      << "  --max-request N         server: largest input in bytes\n"
+      << "                          (default 67108864)\n"
+      << "  --max-connections N     socket: clients served at once\n"
+      << "                          (default 16)\n"
+      << "  --stats FILE            write timings and tree stats as JSON\n"
+      << "  -j, --threads N         threads per image for the build, painting\n"
+      << "                          and GIF frames (default 1)\n"
+      << "  --parallel-cutoff N     smallest block built as a task\n"
+      << "  --engine top-down|bottom-up|best-first\n"
+      << "                          quadtree build engine (default top-down)\n"
+      << "  --max-leaves N          best-first: stop before N leaves\n"
+      << "  --max-bytes N           best-first: stop before N bytes of nodes\n"
+      << "  --max-ms N              best-first: stop after N milliseconds"
+      << std::endl;
+}
+
+int main(int argc, char** argv) {
+  BatchOptions batch;
+  ServerOptions server;
+  bool serve = false;
+  std::vector<std::string> paths, listFiles;
+  bool valid = true;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if ((arg == "--threads" || arg == "-j") && hasValue) {
+      batch.build.threadCount = std::atoi(argv[++i]);
+    } else if (arg == "--parallel-cutoff" && hasValue) {
+      batch.build.parallelCutoff = std::atoll(argv[++i]);
+    } else if (arg == "--engine" && hasValue) {
+      std::string engine = argv[++i];
+      if (engine == "bottom-up")
+        batch.build.engine = BuildEngine::BottomUp;
+      else if (engine == "best-first")
+        batch.build.engine = BuildEngine::BestFirst;
+      else if (engine != "top-down")
+        valid = false;
+    } else if (arg == "--max-leaves" && hasValue) {
+      batch.build.maxLeaves = std::atoll(argv[++i]);
+    } else if (arg == "--max-bytes" && hasValue) {
+      batch.build.maxBytes = std::atoll(argv[++i]);
+    } else if (arg == "--max-ms" && hasValue) {
+      batch.build.maxSeconds = std::atof(argv[++i]) / 1000;
+    } else if ((arg == "--metric" || arg == "-m") && hasValue) {
+      batch.errorMethod = std::atoi(argv[++i]);
+    } else if ((arg == "--threshold" || arg == "-t") && hasValue) {
+      batch.threshold = std::atof(argv[++i]);
+    } else if ((arg == "--min-block" || arg == "-b") && hasValue) {
+      batch.minBlockSize = std::atoi(argv[++i]);
+    } else if (arg == "--target" && hasValue) {
+      batch.targetCompression = std::atof(argv[++i]);
+    } else if ((arg == "--output" || arg == "-o") && hasValue) {
+      batch.outputDir = argv[++i];
+    } else if (arg == "--format" && hasValue) {
+      std::string format = argv[++i];
+      if (format == "qtc")
+        batch.format = OutputFormat::Qtc;
+      else if (format != "jpg")
+        valid = false;
+    } else if (arg == "--gif") {
+      batch.writeGif = true;
+    } else if (arg == "--list" && hasValue) {
+      listFiles.push_back(argv[++i]);
+    } else if (arg == "--decode-workers" && hasValue) {
+      batch.decodeWorkers = std::atoi(argv[++i]);
+    } else if (arg == "--build-workers" && hasValue) {
+      batch.buildWorkers = std::atoi(argv[++i]);
+    } else if (arg == "--raster-workers" && hasValue) {
+      batch.rasterWorkers = std::atoi(argv[++i]);
+    } else if (arg == "--encode-workers" && hasValue) {
+      batch.encodeWorkers = std::atoi(argv[++i]);
+    } else if (arg == "--queue-depth" && hasValue) {
+      batch.queueDepth = std::atoi(argv[++i]);
+    } else if (arg == "--tile" && hasValue) {
+      batch.tileSize = std::atoi(argv[++i]);
+    } else if (arg == "--sequence" && hasValue) {
+      batch.sequenceTileSize = std::atoi(argv[++i]);
+    } else if (arg == "--serve") {
+      serve = true;
+    } else if (arg == "--socket" && hasValue) {
+      serve = true;
+      server.socketPath = argv[++i];
+    } else if (arg == "--max-request" && hasValue) {
+      server.maxRequestBytes = std::strtoull(argv[++i], nullptr, 10);
+    } else if (arg == "--max-connections" && hasValue) {
+      server.maxConnections = std::atoi(argv[++i]);
+    } else if (arg == "--stats" && hasValue) {
+      batch.statsPath = argv[++i];
+    } else if (!arg.empty() && arg[0] != '-') {
+      paths.push_back(arg);
+    } else {
+      valid = false;
     }
-  } else {
-    std::cerr << "Error: getrlimit() failed." << std::endl;
   }
-}
+  bool batchMode = !paths.empty() || !listFiles.empty();
+  valid = valid && batch.build.threadCount >= 1 &&
+          batch.build.parallelCutoff >= 1 && batch.build.maxLeaves >= 0 &&
+          batch.build.maxBytes >= 0 && batch.build.maxSeconds >= 0;
+  // Budgets only bound the best-first engine, and a budget per tile would
+  // not bound the image.
+  if (batch.build.maxLeaves > 0 || batch.build.maxBytes > 0 ||
+      batch.build.maxSeconds > 0)
+    valid = valid && batch.build.engine == BuildEngine::BestFirst &&
+            batch.tileSize == 0 && batch.sequenceTileSize == 0;
+  if (batchMode)
+    valid = valid && !batch.outputDir.empty() && batch.errorMethod >= 1 &&
+            batch.errorMethod <= 6 && batch.threshold >= 0 &&
+            batch.minBlockSize > 0 && batch.targetCompression >= 0 &&
+            batch.targetCompression <= 1.0 && batch.decodeWorkers >= 1 &&
+            batch.buildWorkers >= 0 && batch.rasterWorkers >= 1 &&
+            batch.encodeWorkers >= 1 && batch.queueDepth >= 1 &&
+            batch.tileSize >= 0 && batch.sequenceTileSize >= 0;
+  // Tiled mode never holds the whole tree, which the GIF and the target
+  // search need.
+  if (batch.tileSize > 0)
+    valid = valid && batchMode && !batch.writeGif &&
+            batch.targetCompression == 0;
+  // Sequence mode keeps one rendering across frames and writes it as JPEG.
+  if (batch.sequenceTileSize > 0)
+    valid = valid && batchMode && batch.tileSize == 0 && !batch.writeGif &&
+            batch.targetCompression == 0 && batch.format == OutputFormat::Jpeg;
+  // The server takes its images and settings from its requests.
+  if (serve)
+    valid = valid && !batchMode && batch.buildWorkers >= 0 &&
+            batch.queueDepth >= 1 && server.maxRequestBytes >= 1 &&
+            server.maxConnections >= 1;
+  if (!valid) {
+    printUsage(argv[0]);
+    return 1;
+  }
 
-int main() {
-  increaseStackSize();
-  ImageCompressor compressor;
-  compressor.run();
-  return 0;
+  FreeImage_Initialise();
+  int status = 0;
+  try {
+    if (serve) {
+      server.workers = batch.buildWorkers;
+      server.queueDepth = batch.queueDepth;
+      server.build = batch.build;
+      CompressionServer(server).serve();
+    } else if (batchMode) {
+      BatchPipeline pipeline(batch);
+      status = pipeline.run(BatchPipeline::collectInputs(paths, listFiles))
+                   ? 1
+                   : 0;
+    } else {
+      ImageCompressor compressor;
+      compressor.setBuildOptions(batch.build);
+      compressor.setStatsPath(batch.statsPath);
+      compressor.run();
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    status = 1;
+  }
+  FreeImage_DeInitialise();
+  return status;
 }
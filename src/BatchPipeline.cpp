@@ -0,0 +1,401 @@
+#include "BatchPipeline.hpp"
+
+#include <FreeImage.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#include "BoundedQueue.hpp"
+#include "GifEncoder.hpp"
+#include "ImageCompressor.hpp"
+#include "SequenceCompressor.hpp"
+#include "TiledCompressor.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const int kGifFrameDelay = 50;  // hundredths of a second, as in saveGif
+
+// Everything known about one image as it moves down the pipeline. Stages
+// release what later stages no longer need.
+struct BatchJob {
+  std::string inputPath, outputPath, gifPath;
+  std::chrono::steady_clock::time_point start;
+  Image pixels;
+  std::unique_ptr<Metric> metric;
+  std::unique_ptr<Quadtree> tree;
+  FIBITMAP* bitmap = nullptr;
+  std::vector<uint8_t> encoded;  // the output, once searched or encoded
+  ByteCounts bytes;
+  RunStats stats{false};  // images overlap, so no process-wide peak RSS
+
+  ~BatchJob() {
+    if (bitmap) FreeImage_Unload(bitmap);
+  }
+};
+
+using JobPtr = std::unique_ptr<BatchJob>;
+
+// Progress lines are printed as images finish, in completion order.
+class BatchReport {
+ private:
+  std::mutex lock;
+  int succeeded = 0, failed = 0;
+  std::vector<std::string> stats;  // JSON objects of the finished images
+
+ public:
+  void success(const BatchJob& job) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - job.start;
+    double compression =
+        (1 - static_cast<double>(job.bytes.output) / job.bytes.input) * 100;
+    RunStats stats = job.stats;
+    stats.set("input_bytes", static_cast<double>(job.bytes.input));
+    stats.set("output_bytes", static_cast<double>(job.bytes.output));
+    stats.set("seconds", elapsed.count());
+    std::lock_guard<std::mutex> guard(lock);
+    succeeded++;
+    this->stats.push_back(stats.toJson());
+    printf("[OK] %s -> %s (%.2f%%, %.2f sec)\n", job.inputPath.c_str(),
+           job.outputPath.c_str(), compression, elapsed.count());
+  }
+  void failure(const BatchJob& job, const std::string& message) {
+    std::lock_guard<std::mutex> guard(lock);
+    failed++;
+    fprintf(stderr, "[FAILED] %s: %s\n", job.inputPath.c_str(),
+            message.c_str());
+  }
+  int getSucceeded() const { return succeeded; }
+  int getFailed() const { return failed; }
+  const std::vector<std::string>& getStats() const { return stats; }
+};
+
+// A job for one input, with the output paths derived from its name.
+JobPtr newJob(const BatchOptions& options, const std::string& input) {
+  JobPtr job(new BatchJob());
+  job->inputPath = input;
+  std::string stem = fs::path(input).stem().string();
+  std::string extension = options.format == OutputFormat::Qtc ? ".qtc" : ".jpg";
+  job->outputPath = (fs::path(options.outputDir) / (stem + extension)).string();
+  if (options.writeGif)
+    job->gifPath = (fs::path(options.outputDir) / (stem + ".gif")).string();
+  job->start = std::chrono::steady_clock::now();
+  return job;
+}
+
+// Outputs are named after the input's stem alone, so inputs such as d1/x.png
+// and d2/x.jpg would write the same file. The first input in the list keeps
+// the name; the others are reported as failed and dropped before any work
+// starts, rather than silently overwriting it.
+std::vector<std::string> dropCollisions(const BatchOptions& options,
+                                        const std::vector<std::string>& inputs,
+                                        BatchReport& report) {
+  std::vector<std::string> kept;
+  std::unordered_map<std::string, std::string> owners;  // output to input
+  for (const std::string& input : inputs) {
+    JobPtr job = newJob(options, input);
+    auto claimed = owners.emplace(job->outputPath, input);
+    if (claimed.second) {
+      kept.push_back(input);
+      continue;
+    }
+    report.failure(*job, "output " + job->outputPath + " is taken by " +
+                             claimed.first->second);
+  }
+  return kept;
+}
+
+// The settings every stats entry starts with.
+void recordSettings(const BatchOptions& options, BatchJob& job) {
+  job.stats.set("input", job.inputPath);
+  job.stats.set("output", job.outputPath);
+  job.stats.set("metric", options.errorMethod);
+  job.stats.set("threshold", options.threshold);
+  job.stats.set("min_block_size", options.minBlockSize);
+  job.stats.set("target_compression", options.targetCompression);
+}
+
+// Print the batch summary, write the stats file if one was asked for, and
+// return the number of failed images.
+int finishBatch(const BatchOptions& options, const BatchReport& report,
+                std::chrono::steady_clock::time_point batchStart) {
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - batchStart;
+  printf("[INFO] Batch: %d succeeded, %d failed in %.2f sec\n",
+         report.getSucceeded(), report.getFailed(), elapsed.count());
+
+  if (!options.statsPath.empty()) {
+    std::ofstream file(options.statsPath);
+    file << "[";
+    const std::vector<std::string>& stats = report.getStats();
+    for (size_t i = 0; i < stats.size(); i++)
+      file << (i ? ",\n " : "") << stats[i];
+    file << "]" << std::endl;
+    if (!file)
+      throw std::runtime_error("Failed to write stats to " + options.statsPath);
+    printf("[OUTPUT] Stats saved at: %s\n", options.statsPath.c_str());
+  }
+  return report.getFailed();
+}
+
+// Start one pipeline stage: each worker takes jobs from source until it is
+// exhausted, runs step on them and forwards successful jobs to sink (or
+// reports them if this is the last stage). The last worker to finish closes
+// sink so the next stage sees the end of the stream.
+void startStage(std::vector<std::thread>& threads, int workers,
+                std::function<bool(JobPtr&)> source,
+                std::function<void(BatchJob&)> step,
+                BoundedQueue<JobPtr>* sink, BatchReport& report) {
+  auto remaining = std::make_shared<std::atomic<int>>(workers);
+  for (int i = 0; i < workers; i++) {
+    threads.emplace_back([=, &report] {
+      JobPtr job;
+      while (source(job)) {
+        try {
+          step(*job);
+        } catch (const std::exception& e) {
+          report.failure(*job, e.what());
+          continue;
+        }
+        if (!sink)
+          report.success(*job);
+        else
+          sink->push(std::move(job));
+      }
+      if (--*remaining == 0 && sink) sink->close();
+    });
+  }
+}
+
+}  // namespace
+
+BatchPipeline::BatchPipeline(const BatchOptions& options) : options(options) {
+  if (this->options.buildWorkers < 1)
+    this->options.buildWorkers =
+        std::max(1u, std::thread::hardware_concurrency());
+  // Only the .qtc stream can be written without the whole tree.
+  if (this->options.tileSize > 0) this->options.format = OutputFormat::Qtc;
+  if (this->options.build.threadCount > 1) {
+    pool.reset(new ThreadPool(this->options.build.threadCount));
+    this->options.build.pool = pool.get();
+  }
+}
+
+std::vector<std::string> BatchPipeline::collectInputs(
+    const std::vector<std::string>& paths,
+    const std::vector<std::string>& listFiles) {
+  std::vector<std::string> inputs;
+  for (const std::string& path : paths) {
+    if (!fs::is_directory(path)) {
+      inputs.push_back(path);
+      continue;
+    }
+    std::vector<std::string> entries;
+    for (const fs::directory_entry& entry : fs::directory_iterator(path)) {
+      std::string file = entry.path().string();
+      if (entry.is_regular_file() &&
+          FreeImage_GetFIFFromFilename(file.c_str()) != FIF_UNKNOWN)
+        entries.push_back(file);
+    }
+    std::sort(entries.begin(), entries.end());
+    inputs.insert(inputs.end(), entries.begin(), entries.end());
+  }
+  for (const std::string& listFile : listFiles) {
+    std::ifstream file;
+    if (listFile != "-") {
+      file.open(listFile);
+      if (!file) throw std::runtime_error("Cannot open list " + listFile);
+    }
+    std::istream& in = listFile == "-" ? std::cin : file;
+    std::string line;
+    while (std::getline(in, line))
+      if (!line.empty()) inputs.push_back(line);
+  }
+  return inputs;
+}
+
+int BatchPipeline::run(const std::vector<std::string>& allInputs) {
+  fs::create_directories(options.outputDir);
+  if (options.tileSize > 0) return runTiled(allInputs);
+  if (options.sequenceTileSize > 0) return runSequence(allInputs);
+  auto batchStart = std::chrono::steady_clock::now();
+
+  BatchReport report;
+  std::vector<std::string> inputs = dropCollisions(options, allInputs, report);
+  BoundedQueue<JobPtr> decoded(options.queueDepth);
+  BoundedQueue<JobPtr> built(options.queueDepth);
+  BoundedQueue<JobPtr> rasterized(options.queueDepth);
+  std::vector<std::thread> threads;
+
+  // The input list itself feeds the decoders.
+  std::atomic<size_t> nextInput(0);
+  auto claimInput = [&](JobPtr& job) -> bool {
+    size_t index = nextInput++;
+    if (index >= inputs.size()) return false;
+    job = newJob(options, inputs[index]);
+    return true;
+  };
+  auto popFrom = [](BoundedQueue<JobPtr>& queue) {
+    return [&queue](JobPtr& job) { return queue.pop(job); };
+  };
+
+  startStage(
+      threads, options.decodeWorkers, claimInput,
+      [](BatchJob& job) {
+        ScopedPhase phase(job.stats, "decode");
+        job.bytes.input = loadImage(job.inputPath, job.pixels);
+      },
+      &decoded, report);
+
+  startStage(
+      threads, options.buildWorkers, popFrom(decoded),
+      [this](BatchJob& job) {
+        bool searching = options.targetCompression > 0;
+        double buildThreshold = searching
+                                    ? -std::numeric_limits<double>::infinity()
+                                    : options.threshold;
+        job.metric = createMetric(options.errorMethod);
+        // The search prunes the tree by its errors.
+        BuildOptions build = options.build;
+        build.exactErrors = searching;
+        {
+          ScopedPhase phase(job.stats, "build");
+          job.tree.reset(new Quadtree(job.pixels.view(), buildThreshold,
+                                      job.metric.get(), options.minBlockSize,
+                                      build));
+        }
+        if (searching) {
+          ScopedPhase phase(job.stats, "search");
+          TargetSearch result = findTargetThreshold(
+              *job.tree, job.bytes.input, options.targetCompression,
+              options.format, options.build.threadCount);
+          job.encoded.swap(result.encoded);
+        }
+        // Record the tree now; the rasterizer may release it.
+        if (!options.statsPath.empty()) {
+          recordSettings(options, job);
+          job.stats.set("width", job.pixels.getWidth());
+          job.stats.set("height", job.pixels.getHeight());
+          job.stats.addTree(*job.tree);
+        }
+      },
+      &built, report);
+
+  startStage(
+      threads, options.rasterWorkers, popFrom(built),
+      [this](BatchJob& job) {
+        // .qtc output is encoded straight from the tree, and the search has
+        // already encoded its output.
+        if (job.encoded.empty()) {
+          if (options.format == OutputFormat::Qtc) return;
+          ScopedPhase phase(job.stats, "rasterize");
+          job.bitmap = job.tree->createImage(std::numeric_limits<int>::max(),
+                                             false, options.build.threadCount);
+          if (!job.bitmap) throw std::runtime_error("Cannot allocate bitmap");
+        }
+        // Only the GIF still needs the tree, which views the pixels.
+        if (!options.writeGif) {
+          job.tree.reset();
+          job.pixels = Image();
+        }
+      },
+      &rasterized, report);
+
+  startStage(
+      threads, options.encodeWorkers, popFrom(rasterized),
+      [this](BatchJob& job) {
+        if (job.encoded.empty()) {
+          ScopedPhase phase(job.stats, "encode");
+          if (!job.bitmap) {
+            QtcCodec::encode(*job.tree, job.encoded);
+          } else {
+            encodeJpeg(job.bitmap, job.encoded);
+            FreeImage_Unload(job.bitmap);
+            job.bitmap = nullptr;
+          }
+        }
+        // The GIF is written first, so an image reported as failed never
+        // leaves its main output behind.
+        if (!job.gifPath.empty()) {
+          ScopedPhase phase(job.stats, "gif");
+          if (!saveQuadtreeGif(*job.tree, job.gifPath, kGifFrameDelay, true,
+                               options.build.threadCount))
+            throw std::runtime_error("Failed to write " + job.gifPath);
+          job.tree.reset();
+          job.pixels = Image();
+        }
+        {
+          ScopedPhase phase(job.stats, "write");
+          writeFile(job.encoded, job.outputPath);
+        }
+        job.bytes.output = static_cast<long long>(job.encoded.size());
+        job.encoded = std::vector<uint8_t>();
+      },
+      nullptr, report);
+
+  for (std::thread& thread : threads) thread.join();
+  return finishBatch(options, report, batchStart);
+}
+
+// Tiled mode compresses one image at a time: each image is already worked
+// through tile by tile, and overlapping several would multiply the memory
+// the tiles are there to bound.
+int BatchPipeline::runTiled(const std::vector<std::string>& allInputs) {
+  auto batchStart = std::chrono::steady_clock::now();
+  BatchReport report;
+  std::vector<std::string> inputs = dropCollisions(options, allInputs, report);
+  TiledCompressor compressor(options.errorMethod, options.threshold,
+                             options.minBlockSize, options.tileSize,
+                             options.build);
+  for (const std::string& input : inputs) {
+    JobPtr job = newJob(options, input);
+    recordSettings(options, *job);
+    try {
+      job->bytes =
+          compressor.compress(job->inputPath, job->outputPath, job->stats);
+    } catch (const std::exception& e) {
+      report.failure(*job, e.what());
+      continue;
+    }
+    report.success(*job);
+  }
+  return finishBatch(options, report, batchStart);
+}
+
+// Sequence mode compresses the frames in input order, each against the
+// one before it. A frame that cannot be read is skipped, and the next one is
+// compared with the last frame that was read.
+int BatchPipeline::runSequence(const std::vector<std::string>& allInputs) {
+  auto batchStart = std::chrono::steady_clock::now();
+  BatchReport report;
+  std::vector<std::string> inputs = dropCollisions(options, allInputs, report);
+  SequenceCompressor compressor(options.errorMethod, options.threshold,
+                                options.minBlockSize, options.sequenceTileSize,
+                                options.build);
+  for (const std::string& input : inputs) {
+    JobPtr job = newJob(options, input);
+    recordSettings(options, *job);
+    try {
+      job->bytes =
+          compressor.compress(job->inputPath, job->outputPath, job->stats);
+    } catch (const std::exception& e) {
+      report.failure(*job, e.what());
+      continue;
+    }
+    report.success(*job);
+  }
+  return finishBatch(options, report, batchStart);
+}
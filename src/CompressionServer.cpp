@@ -0,0 +1,297 @@
+#include "CompressionServer.hpp"
+
+#include <FreeImage.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "QtcCodec.hpp"
+#include "Rasterizer.hpp"
+
+namespace {
+
+const size_t kMaxHeaderBytes = 256;
+
+// Buffered reads from a file descriptor, so header lines do not cost a
+// system call per byte.
+class FdReader {
+ private:
+  int fd;
+  char buffer[1 << 16];
+  size_t begin, end;
+
+  bool fill() {
+    ssize_t n;
+    do {
+      n = ::read(fd, buffer, sizeof(buffer));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return false;
+    begin = 0;
+    end = static_cast<size_t>(n);
+    return true;
+  }
+
+ public:
+  explicit FdReader(int fd) : fd(fd), begin(0), end(0) {}
+
+  // Read up to a newline, which is dropped. Returns false at the end of the
+  // input, or if no newline comes within max bytes.
+  bool readLine(std::string& line, size_t max) {
+    line.clear();
+    while (true) {
+      if (begin == end && !fill()) return false;
+      char* newline =
+          static_cast<char*>(std::memchr(buffer + begin, '\n', end - begin));
+      size_t take = (newline ? newline - buffer : end) - begin;
+      line.append(buffer + begin, take);
+      begin += take;
+      if (line.size() > max) return false;
+      if (newline) {
+        begin++;
+        return true;
+      }
+    }
+  }
+
+  // Append size bytes to out one buffer at a time, so out only grows with
+  // the bytes that actually arrive.
+  bool readBytes(std::vector<uint8_t>& out, size_t size) {
+    while (size > 0) {
+      if (begin == end && !fill()) return false;
+      size_t take = std::min(size, end - begin);
+      out.insert(out.end(), buffer + begin, buffer + begin + take);
+      begin += take;
+      size -= take;
+    }
+    return true;
+  }
+};
+
+bool writeAll(int fd, const void* data, size_t size) {
+  const char* bytes = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = ::write(fd, bytes, size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    bytes += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+}  // namespace
+
+// Everything a worker keeps between requests.
+struct CompressionServer::Worker {
+  std::unique_ptr<Metric> metrics[7];  // by error method, created on demand
+  Image pixels;
+  TreeStorage storage;
+  FIBITMAP* bitmap = nullptr;  // kept while the image size repeats
+
+  ~Worker() {
+    if (bitmap) FreeImage_Unload(bitmap);
+  }
+
+  Metric* metric(int errorMethod) {
+    if (!metrics[errorMethod])
+      metrics[errorMethod] = createMetric(errorMethod);
+    return metrics[errorMethod].get();
+  }
+
+  // Render the tree into the kept bitmap, reallocating it only when the
+  // size changes.
+  FIBITMAP* render(const Quadtree& tree, int threadCount) {
+    int width = tree.getRootBlock().width;
+    int height = tree.getRootBlock().height;
+    if (bitmap && (static_cast<int>(FreeImage_GetWidth(bitmap)) != width ||
+                   static_cast<int>(FreeImage_GetHeight(bitmap)) != height)) {
+      FreeImage_Unload(bitmap);
+      bitmap = nullptr;
+    }
+    if (!bitmap) bitmap = FreeImage_Allocate(width, height, 24);
+    if (!bitmap) throw std::runtime_error("Cannot allocate bitmap");
+    RasterOptions options;
+    options.threadCount = threadCount;
+    options.pool = tree.getBuildOptions().pool;
+    Rasterizer::paint(tree, PixelBuffer::fromBitmap(bitmap), options);
+    return bitmap;
+  }
+};
+
+CompressionServer::CompressionServer(const ServerOptions& options)
+    : options(options),
+      tasks(static_cast<size_t>(std::max(1, options.queueDepth))),
+      connections(0) {
+  if (this->options.maxConnections < 1) this->options.maxConnections = 1;
+  if (this->options.workers < 1)
+    this->options.workers =
+        std::max(1u, std::thread::hardware_concurrency());
+  if (this->options.build.threadCount > 1) {
+    pool.reset(new ThreadPool(this->options.build.threadCount));
+    this->options.build.pool = pool.get();
+  }
+}
+
+// Take requests from any connection until the server shuts down.
+void CompressionServer::work() {
+  Worker worker;
+  Task task;
+  while (tasks.pop(task)) {
+    const Request& request = task.request;
+    Response response{true, std::string(), std::vector<uint8_t>()};
+    try {
+      decodeImage(request.input, worker.pixels);
+      Quadtree tree(worker.pixels.view(), request.threshold,
+                    worker.metric(request.errorMethod), request.minBlockSize,
+                    options.build, &worker.storage);
+      if (request.format == OutputFormat::Qtc)
+        response.output = QtcCodec::encode(tree);
+      else
+        encodeJpeg(worker.render(tree, options.build.threadCount),
+                   response.output);
+    } catch (const std::exception& e) {
+      response = Response{false, e.what(), std::vector<uint8_t>()};
+    }
+    task.response.set_value(std::move(response));
+  }
+}
+
+// Read requests from in and hand them to the workers, while a writer thread
+// sends the responses to out in request order.
+void CompressionServer::serveConnection(int in, int out) {
+  BoundedQueue<std::future<Response>> pending(options.queueDepth);
+  std::thread writer([&] {
+    bool open = true;
+    std::future<Response> next;
+    while (pending.pop(next)) {
+      Response response = next.get();
+      if (!open) continue;
+      std::string header;
+      if (response.ok) {
+        header = "ok " + std::to_string(response.output.size()) + "\n";
+      } else {
+        std::replace(response.error.begin(), response.error.end(), '\n', ' ');
+        header = "error " + response.error + "\n";
+      }
+      open = writeAll(out, header.data(), header.size()) &&
+             writeAll(out, response.output.data(), response.output.size());
+    }
+  });
+
+  FdReader reader(in);
+  std::string line;
+  while (reader.readLine(line, kMaxHeaderBytes)) {
+    Task task;
+    Request& request = task.request;
+    std::istringstream fields(line);
+    std::string format, rest;
+    uint64_t size = 0;
+    bool valid = static_cast<bool>(fields >> request.errorMethod >>
+                                   request.threshold >>
+                                   request.minBlockSize >> format >> size) &&
+                 !(fields >> rest) && request.errorMethod >= 1 &&
+                 request.errorMethod <= 6 && request.threshold >= 0 &&
+                 request.minBlockSize > 0 &&
+                 (format == "jpg" || format == "qtc");
+    std::string error = "malformed request";
+    if (valid && size > options.maxRequestBytes) {
+      error = "request of " + std::to_string(size) +
+              " bytes exceeds the limit of " +
+              std::to_string(options.maxRequestBytes);
+      valid = false;
+    }
+    if (valid) {
+      request.format =
+          format == "qtc" ? OutputFormat::Qtc : OutputFormat::Jpeg;
+      valid = reader.readBytes(request.input, static_cast<size_t>(size));
+    }
+    if (!valid) {
+      std::promise<Response> rejected;
+      rejected.set_value(Response{false, error, std::vector<uint8_t>()});
+      pending.push(rejected.get_future());
+      break;
+    }
+    pending.push(task.response.get_future());
+    tasks.push(std::move(task));
+  }
+  pending.close();
+  writer.join();
+}
+
+void CompressionServer::listen() {
+  sockaddr_un address;
+  std::memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (options.socketPath.size() >= sizeof(address.sun_path))
+    throw std::runtime_error("Socket path too long: " + options.socketPath);
+  std::strcpy(address.sun_path, options.socketPath.c_str());
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listener < 0) throw std::runtime_error("Cannot create socket");
+  unlink(options.socketPath.c_str());  // left over from an earlier run
+  if (bind(listener, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      ::listen(listener, SOMAXCONN) != 0) {
+    close(listener);
+    throw std::runtime_error("Cannot listen on " + options.socketPath);
+  }
+  fprintf(stderr, "[INFO] Listening on %s\n", options.socketPath.c_str());
+  while (true) {
+    // Leave further clients in the backlog until a connection closes.
+    {
+      std::unique_lock<std::mutex> guard(connectionLock);
+      connectionClosed.wait(
+          guard, [&] { return connections < options.maxConnections; });
+    }
+    int connection = accept(listener, nullptr, nullptr);
+    if (connection < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      close(listener);
+      throw std::runtime_error("Failed to accept on " + options.socketPath);
+    }
+    {
+      std::lock_guard<std::mutex> guard(connectionLock);
+      connections++;
+    }
+    std::thread([this, connection] {
+      serveConnection(connection, connection);
+      close(connection);
+      {
+        std::lock_guard<std::mutex> guard(connectionLock);
+        connections--;
+      }
+      connectionClosed.notify_one();
+    }).detach();
+  }
+}
+
+// A client that goes away must not kill the server, so writes to a closed
+// connection fail with EPIPE instead of raising SIGPIPE.
+void CompressionServer::serve() {
+  signal(SIGPIPE, SIG_IGN);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < options.workers; i++)
+    workers.emplace_back([this] { work(); });
+  try {
+    if (options.socketPath.empty())
+      serveConnection(STDIN_FILENO, STDOUT_FILENO);
+    else
+      listen();
+  } catch (...) {
+    tasks.close();
+    for (std::thread& worker : workers) worker.join();
+    throw;
+  }
+  tasks.close();
+  for (std::thread& worker : workers) worker.join();
+}
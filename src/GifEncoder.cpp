@@ -0,0 +1,445 @@
+#include "GifEncoder.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+#include "Quadtree.hpp"
+#include "ThreadPool.hpp"
+
+namespace {
+
+const int kMaxCode = 4095;
+const int kTableBits = 13;
+
+// Packs LSB-first variable-width codes into 255-byte data sub-blocks.
+class CodeWriter {
+ private:
+  std::vector<uint8_t>& out;
+  uint8_t block[255];
+  int blockSize;
+  uint32_t buffer;
+  int bits;
+
+  void push(uint8_t byte) {
+    block[blockSize++] = byte;
+    if (blockSize == 255) flushBlock();
+  }
+  void flushBlock() {
+    if (blockSize == 0) return;
+    out.push_back(static_cast<uint8_t>(blockSize));
+    out.insert(out.end(), block, block + blockSize);
+    blockSize = 0;
+  }
+
+ public:
+  explicit CodeWriter(std::vector<uint8_t>& out)
+      : out(out), blockSize(0), buffer(0), bits(0) {}
+
+  void write(int code, int size) {
+    buffer |= static_cast<uint32_t>(code) << bits;
+    bits += size;
+    while (bits >= 8) {
+      push(static_cast<uint8_t>(buffer));
+      buffer >>= 8;
+      bits -= 8;
+    }
+  }
+  void finish() {
+    if (bits > 0) push(static_cast<uint8_t>(buffer));
+    buffer = 0;
+    bits = 0;
+    flushBlock();
+    out.push_back(0);
+  }
+};
+
+void writeShort(std::vector<uint8_t>& out, int value) {
+  out.push_back(static_cast<uint8_t>(value & 0xff));
+  out.push_back(static_cast<uint8_t>((value >> 8) & 0xff));
+}
+
+uint32_t packColor(const QuadtreeNode& node) {
+  return (static_cast<uint32_t>(node.r) << 16) | (node.g << 8) | node.b;
+}
+
+int channel(uint32_t rgb, int c) { return (rgb >> (16 - 8 * c)) & 0xff; }
+
+struct WeightedColor {
+  uint32_t rgb;
+  long long weight;
+};
+
+// Median-cut quantisation: keep splitting the box with the widest channel
+// range at its weighted median until there are maxColors boxes or every box
+// holds a single color. Fills lookup with the palette index of every input
+// color, so images with few colors are reproduced exactly.
+std::vector<Color> medianCut(std::vector<WeightedColor>& colors,
+                             int maxColors,
+                             std::unordered_map<uint32_t, uint8_t>& lookup) {
+  struct Box {
+    size_t begin, end;
+    int axis, range;
+  };
+  auto measure = [&](Box& box) {
+    box.axis = 0;
+    box.range = 0;
+    for (int c = 0; c < 3; c++) {
+      int low = 255, high = 0;
+      for (size_t i = box.begin; i < box.end; i++) {
+        low = std::min(low, channel(colors[i].rgb, c));
+        high = std::max(high, channel(colors[i].rgb, c));
+      }
+      if (high - low > box.range) {
+        box.range = high - low;
+        box.axis = c;
+      }
+    }
+  };
+
+  std::vector<Box> boxes;
+  if (!colors.empty()) {
+    boxes.push_back(Box{0, colors.size(), 0, 0});
+    measure(boxes[0]);
+  }
+  while (static_cast<int>(boxes.size()) < maxColors) {
+    size_t widest = boxes.size();
+    for (size_t i = 0; i < boxes.size(); i++)
+      if (boxes[i].range > 0 &&
+          (widest == boxes.size() || boxes[i].range > boxes[widest].range))
+        widest = i;
+    if (widest == boxes.size()) break;
+
+    Box box = boxes[widest];
+    int axis = box.axis;
+    std::sort(colors.begin() + box.begin, colors.begin() + box.end,
+              [&](const WeightedColor& a, const WeightedColor& b) {
+                return channel(a.rgb, axis) < channel(b.rgb, axis);
+              });
+    long long total = 0;
+    for (size_t i = box.begin; i < box.end; i++) total += colors[i].weight;
+    long long seen = 0;
+    size_t split = box.begin + 1;
+    for (size_t i = box.begin; i + 1 < box.end; i++) {
+      seen += colors[i].weight;
+      split = i + 1;
+      if (2 * seen >= total) break;
+    }
+    boxes[widest] = Box{box.begin, split, 0, 0};
+    boxes.push_back(Box{split, box.end, 0, 0});
+    measure(boxes[widest]);
+    measure(boxes.back());
+  }
+
+  std::vector<Color> palette;
+  for (const Box& box : boxes) {
+    long long sum[3] = {0, 0, 0}, total = 0;
+    for (size_t i = box.begin; i < box.end; i++) {
+      for (int c = 0; c < 3; c++)
+        sum[c] += channel(colors[i].rgb, c) * colors[i].weight;
+      total += colors[i].weight;
+      lookup[colors[i].rgb] = static_cast<uint8_t>(palette.size());
+    }
+    palette.push_back(Color{static_cast<int>((sum[0] + total / 2) / total),
+                            static_cast<int>((sum[1] + total / 2) / total),
+                            static_cast<int>((sum[2] + total / 2) / total)});
+  }
+  return palette;
+}
+
+}  // namespace
+
+GifEncoder::GifEncoder() : width(0), height(0), minCodeSize(2) {}
+
+GifEncoder::~GifEncoder() {
+  if (file.is_open()) close();
+}
+
+bool GifEncoder::open(const std::string& path, int width, int height,
+                      const std::vector<Color>& palette, int loopCount) {
+  if (palette.empty() || palette.size() > 256) return false;
+  file.open(path, std::ios::binary | std::ios::trunc);
+  if (!file) return false;
+  this->width = width;
+  this->height = height;
+
+  // The global color table holds 2^(tableBits + 1) entries.
+  int tableBits = 0;
+  while ((2u << tableBits) < palette.size()) tableBits++;
+  minCodeSize = std::max(2, tableBits + 1);
+
+  std::vector<uint8_t> header = {'G', 'I', 'F', '8', '9', 'a'};
+  writeShort(header, width);
+  writeShort(header, height);
+  header.push_back(static_cast<uint8_t>(0xf0 | tableBits));
+  header.push_back(0);  // background color index
+  header.push_back(0);  // pixel aspect ratio
+  for (int i = 0; i < (2 << tableBits); i++) {
+    Color color = i < static_cast<int>(palette.size()) ? palette[i]
+                                                       : Color{0, 0, 0};
+    header.push_back(static_cast<uint8_t>(color.r));
+    header.push_back(static_cast<uint8_t>(color.g));
+    header.push_back(static_cast<uint8_t>(color.b));
+  }
+
+  // NETSCAPE2.0 application extension with the loop count.
+  const char* netscape = "NETSCAPE2.0";
+  header.insert(header.end(), {0x21, 0xff, 0x0b});
+  header.insert(header.end(), netscape, netscape + 11);
+  header.insert(header.end(), {0x03, 0x01});
+  writeShort(header, loopCount);
+  header.push_back(0);
+
+  file.write(reinterpret_cast<const char*>(header.data()), header.size());
+  return static_cast<bool>(file);
+}
+
+bool GifEncoder::addFrame(const uint8_t* indices, size_t pitch, int x, int y,
+                          int width, int height, int delay) {
+  if (!file.is_open() || width <= 0 || height <= 0) return false;
+  return addEncodedFrame(
+      encodeImageData(indices, pitch, width, height, minCodeSize), x, y,
+      width, height, delay);
+}
+
+bool GifEncoder::addEncodedFrame(const std::vector<uint8_t>& data, int x,
+                                 int y, int width, int height, int delay) {
+  if (!file.is_open() || width <= 0 || height <= 0) return false;
+  std::vector<uint8_t> frame;
+
+  // Graphic control extension: disposal method 1 leaves the frame in place.
+  frame.insert(frame.end(), {0x21, 0xf9, 0x04, 0x04});
+  writeShort(frame, delay);
+  frame.insert(frame.end(), {0x00, 0x00});
+
+  // Image descriptor without a local color table.
+  frame.push_back(0x2c);
+  writeShort(frame, x);
+  writeShort(frame, y);
+  writeShort(frame, width);
+  writeShort(frame, height);
+  frame.push_back(0);
+  frame.insert(frame.end(), data.begin(), data.end());
+  file.write(reinterpret_cast<const char*>(frame.data()), frame.size());
+  return static_cast<bool>(file);
+}
+
+bool GifEncoder::close() {
+  if (!file.is_open()) return false;
+  file.put(0x3b);
+  bool ok = static_cast<bool>(file);
+  file.close();
+  return ok && !file.fail();
+}
+
+// Standard variable-width LZW. The string table is an open-addressing hash
+// from (prefix code, next index) to code, so no per-entry allocation is
+// needed, and it is reset with a clear code once all 4096 codes are in use.
+std::vector<uint8_t> GifEncoder::encodeImageData(const uint8_t* indices,
+                                                 size_t pitch, int width,
+                                                 int height, int minCodeSize) {
+  std::vector<uint8_t> out;
+  out.push_back(static_cast<uint8_t>(minCodeSize));
+  CodeWriter writer(out);
+
+  const int clearCode = 1 << minCodeSize;
+  const int endCode = clearCode + 1;
+  const size_t mask = (size_t(1) << kTableBits) - 1;
+  std::vector<int32_t> keys(mask + 1, -1);
+  std::vector<uint16_t> codes(mask + 1);
+  int codeSize = minCodeSize + 1;
+  int nextCode = endCode + 1;
+  writer.write(clearCode, codeSize);
+
+  int current = -1;
+  for (int y = 0; y < height; y++) {
+    const uint8_t* row = indices + static_cast<size_t>(y) * pitch;
+    for (int x = 0; x < width; x++) {
+      int value = row[x];
+      if (current < 0) {
+        current = value;
+        continue;
+      }
+      int32_t key = (current << 8) | value;
+      size_t slot = (static_cast<uint32_t>(key) * 2654435761u) >>
+                    (32 - kTableBits);
+      while (keys[slot] != -1 && keys[slot] != key) slot = (slot + 1) & mask;
+      if (keys[slot] == key) {
+        current = codes[slot];
+        continue;
+      }
+
+      writer.write(current, codeSize);
+      keys[slot] = key;
+      codes[slot] = static_cast<uint16_t>(nextCode);
+      if (nextCode >= (1 << codeSize)) codeSize++;
+      if (nextCode == kMaxCode) {
+        writer.write(clearCode, codeSize);
+        std::fill(keys.begin(), keys.end(), -1);
+        codeSize = minCodeSize + 1;
+        nextCode = endCode + 1;
+      } else {
+        nextCode++;
+      }
+      current = value;
+    }
+  }
+  writer.write(current, codeSize);
+  // The decoder adds one more table entry after the last code, which may
+  // widen the end code.
+  if (nextCode == (1 << codeSize) && codeSize < 12) codeSize++;
+  writer.write(endCode, codeSize);
+  writer.finish();
+  return out;
+}
+
+bool saveQuadtreeGif(const Quadtree& tree, const std::string& path, int delay,
+                     bool outline, int threadCount) {
+  const NodeArena& nodes = tree.getNodes();
+  Block root = tree.getRootBlock();
+  int width = root.width, height = root.height;
+
+  // Every visible node is painted in the frame of its own depth, so the
+  // palette covers all of them, weighted by the area they paint.
+  std::unordered_map<uint32_t, long long> weights;
+  std::vector<std::pair<uint32_t, Block>> stack = {{0, root}};
+  while (!stack.empty()) {
+    uint32_t index = stack.back().first;
+    Block block = stack.back().second;
+    stack.pop_back();
+    weights[packColor(nodes[index])] += block.area();
+    if (nodes[index].isLeaf()) continue;
+    for (int i = 0; i < 4; i++)
+      stack.emplace_back(nodes[index].firstChild + i, block.child(i));
+  }
+  std::vector<WeightedColor> colors;
+  colors.reserve(weights.size());
+  for (const auto& entry : weights)
+    colors.push_back(WeightedColor{entry.first, entry.second});
+  std::sort(colors.begin(), colors.end(),
+            [](const WeightedColor& a, const WeightedColor& b) {
+              return a.rgb < b.rgb;
+            });
+  std::unordered_map<uint32_t, uint8_t> lookup;
+  std::vector<Color> palette = medianCut(colors, outline ? 255 : 256, lookup);
+  uint8_t black = static_cast<uint8_t>(palette.size());
+  if (outline) palette.push_back(Color{0, 0, 0});
+
+  GifEncoder encoder;
+  if (!encoder.open(path, width, height, palette)) return false;
+
+  // Nodes painted in each frame, and the bounding box of each frame in GIF
+  // row order, which is top-down while blocks are bottom-up.
+  struct Box {
+    int left, top, right, bottom;
+  };
+  std::vector<std::vector<std::pair<uint32_t, Block>>> frames;
+  std::vector<Box> boxes;
+  std::vector<std::pair<uint32_t, Block>> frontier = {{0, root}}, next;
+  while (!frontier.empty()) {
+    Box box{INT_MAX, INT_MAX, 0, 0};
+    for (const auto& entry : frontier) {
+      const QuadtreeNode& node = nodes[entry.first];
+      const Block& block = entry.second;
+      int blockTop = height - block.y - block.height;
+      box.left = std::min(box.left, block.x);
+      box.top = std::min(box.top, blockTop);
+      box.right = std::max(box.right, block.x + block.width);
+      box.bottom = std::max(box.bottom, blockTop + block.height);
+      if (node.isLeaf()) continue;
+      for (int i = 0; i < 4; i++)
+        next.emplace_back(node.firstChild + i, block.child(i));
+    }
+    frames.push_back(std::move(frontier));
+    boxes.push_back(box);
+    frontier.swap(next);
+    next.clear();
+  }
+
+  auto fill = [&](std::vector<uint8_t>& canvas, int x, int top, int w, int h,
+                  uint8_t value) {
+    for (int y = top; y < top + h; y++)
+      std::memset(&canvas[static_cast<size_t>(y) * width + x], value, w);
+  };
+  auto paintNode = [&](std::vector<uint8_t>& canvas, uint32_t index,
+                       const Block& block) {
+    int blockTop = height - block.y - block.height;
+    fill(canvas, block.x, blockTop, block.width, block.height,
+         lookup.at(packColor(nodes[index])));
+    if (outline) {
+      fill(canvas, block.x, blockTop, block.width, 1, black);
+      fill(canvas, block.x, blockTop + block.height - 1, block.width, 1, black);
+      fill(canvas, block.x, blockTop, 1, block.height, black);
+      fill(canvas, block.x + block.width - 1, blockTop, 1, block.height, black);
+    }
+  };
+
+  // Frames are made in windows of one per thread. Each slot of a window has
+  // a canvas of its own that catches up by painting the frames since its
+  // last one. The calling thread writes the first frame of a window
+  // directly, and the others are compressed in parallel and written as soon
+  // as the window is done, so at most one frame per thread is held.
+  size_t count = frames.size();
+  size_t runs = std::max<size_t>(1, std::min<size_t>(threadCount, count));
+  std::vector<std::vector<uint8_t>> canvases(
+      runs, std::vector<uint8_t>(static_cast<size_t>(width) * height, 0));
+  std::vector<size_t> painted(runs, 0);
+  std::vector<std::vector<uint8_t>> encoded(runs);
+  int minCodeSize = encoder.getMinCodeSize();
+  auto paintTo = [&](size_t slot, size_t depth) {
+    for (; painted[slot] <= depth; painted[slot]++)
+      for (const auto& entry : frames[painted[slot]])
+        paintNode(canvases[slot], entry.first, entry.second);
+  };
+  auto frameData = [&](size_t slot, const Box& box) {
+    return &canvases[slot][static_cast<size_t>(box.top) * width + box.left];
+  };
+  // Hold the finished image for an extra frame's worth of time.
+  auto frameDelay = [&](size_t depth) {
+    return depth + 1 == count ? 2 * delay : delay;
+  };
+
+  // The tree's build pool is borrowed when it has one.
+  std::unique_ptr<ThreadPool> workers;
+  std::unique_ptr<TaskGroup> group;
+  if (runs > 1) {
+    ThreadPool* pool = tree.getBuildOptions().pool;
+    if (!pool) {
+      workers.reset(new ThreadPool(static_cast<int>(runs) - 1));
+      pool = workers.get();
+    }
+    group.reset(new TaskGroup(*pool));
+  }
+  for (size_t first = 0; first < count; first += runs) {
+    size_t last = std::min(count, first + runs);
+    for (size_t slot = 1; first + slot < last; slot++)
+      group->run([&, slot] {
+        size_t depth = first + slot;
+        const Box& box = boxes[depth];
+        paintTo(slot, depth);
+        encoded[slot] = GifEncoder::encodeImageData(
+            frameData(slot, box), width, box.right - box.left,
+            box.bottom - box.top, minCodeSize);
+      });
+    const Box& box = boxes[first];
+    paintTo(0, first);
+    bool written = encoder.addFrame(
+        frameData(0, box), width, box.left, box.top, box.right - box.left,
+        box.bottom - box.top, frameDelay(first));
+    if (group) group->wait();
+    if (!written) return false;
+    for (size_t slot = 1; first + slot < last; slot++) {
+      const Box& box = boxes[first + slot];
+      if (!encoder.addEncodedFrame(encoded[slot], box.left, box.top,
+                                   box.right - box.left,
+                                   box.bottom - box.top,
+                                   frameDelay(first + slot)))
+        return false;
+      encoded[slot] = std::vector<uint8_t>();
+    }
+  }
+  return encoder.close();
+}
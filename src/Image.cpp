@@ -0,0 +1,59 @@
+#include "Image.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+Image::Image() : width(0), height(0), pitch(0), capacity(0), data(nullptr) {}
+
+// Allocate an uninitialised image; rows are padded to kAlignment bytes.
+Image::Image(int width, int height)
+    : width(width),
+      height(height),
+      pitch((static_cast<size_t>(width) + kAlignment - 1) / kAlignment *
+            kAlignment),
+      capacity(pitch * height * 3),
+      data(nullptr) {
+  if (capacity == 0) return;
+  data = static_cast<uint8_t*>(std::aligned_alloc(kAlignment, capacity));
+  if (!data) throw std::bad_alloc();
+}
+
+Image::Image(const Image& other) : Image(other.width, other.height) {
+  if (data) std::memcpy(data, other.data, pitch * height * 3);
+}
+
+Image::Image(Image&& other) noexcept
+    : width(other.width),
+      height(other.height),
+      pitch(other.pitch),
+      capacity(other.capacity),
+      data(other.data) {
+  other.width = other.height = 0;
+  other.pitch = other.capacity = 0;
+  other.data = nullptr;
+}
+
+Image& Image::operator=(Image other) noexcept {
+  std::swap(width, other.width);
+  std::swap(height, other.height);
+  std::swap(pitch, other.pitch);
+  std::swap(capacity, other.capacity);
+  std::swap(data, other.data);
+  return *this;
+}
+
+void Image::reshape(int width, int height) {
+  size_t pitch = (static_cast<size_t>(width) + kAlignment - 1) / kAlignment *
+                 kAlignment;
+  if (pitch * height * 3 > capacity) {
+    *this = Image(width, height);
+    return;
+  }
+  this->width = width;
+  this->height = height;
+  this->pitch = pitch;
+}
+
+Image::~Image() { std::free(data); }
@@ -1,257 +1,433 @@
 #include "ImageCompressor.hpp"
 
-double getFileSizeInMB(const std::string& filename) {
-  struct stat st;
-  if (stat(filename.c_str(), &st) != 0) return -1;
-  return st.st_size / (1024.0 * 1024.0);
+// Read the whole file at path. Throws std::runtime_error if it cannot be
+// read.
+std::vector<uint8_t> readFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  std::streamoff size = file ? static_cast<std::streamoff>(file.tellg()) : -1;
+  if (size < 0) throw std::runtime_error("Cannot open " + path);
+  std::vector<uint8_t> data(static_cast<size_t>(size));
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(data.data()), size);
+  if (!file) throw std::runtime_error("Cannot read " + path);
+  return data;
 }
 
-// Load image from the input path and populate pixelData.
-void ImageCompressor::loadImageFromPath() {
-  FreeImage_Initialise();
-  FIBITMAP* bitmap =
-      FreeImage_Load(FreeImage_GetFileType(inputImagePath.c_str(), 0),
-                     inputImagePath.c_str(), JPEG_DEFAULT);
-  if (!bitmap) {
-    std::cerr << "Error: Cannot load image from " << inputImagePath
-              << std::endl;
-    exit(1);
+// Write data to path, replacing the file. Throws std::runtime_error if it
+// cannot be written.
+void writeFile(const std::vector<uint8_t>& data, const std::string& path) {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(data.data()), data.size());
+  if (!file) throw std::runtime_error("Failed to write " + path);
+}
+
+// Decode a .qtc stream into a new 24-bit bitmap, or return nullptr if it
+// cannot be read.
+FIBITMAP* decodeQtc(const uint8_t* data, size_t size) {
+  QtcHeader header;
+  if (!QtcCodec::readHeader(data, size, header)) return nullptr;
+  FIBITMAP* bitmap = FreeImage_Allocate(header.width, header.height, 24);
+  if (!bitmap) return nullptr;
+  try {
+    QtcCodec::decode(data, size, PixelBuffer::fromBitmap(bitmap));
+  } catch (const std::exception&) {
+    FreeImage_Unload(bitmap);
+    return nullptr;
+  }
+  return bitmap;
+}
+
+// Copy a decoded bitmap into planar RGB and release it. name identifies the
+// image in errors.
+void copyBitmap(FIBITMAP* bitmap, Image& pixelData, const std::string& name) {
+  // 24- and 32-bit bitmaps are read in place; anything else (palettised,
+  // greyscale, high bit depth) is converted to 24 bits once.
+  unsigned bpp = FreeImage_GetBPP(bitmap);
+  if (FreeImage_GetImageType(bitmap) != FIT_BITMAP ||
+      (bpp != 24 && bpp != 32)) {
+    FIBITMAP* converted = FreeImage_ConvertTo24Bits(bitmap);
+    FreeImage_Unload(bitmap);
+    bitmap = converted;
+    if (!bitmap) throw std::runtime_error("Cannot convert image " + name);
   }
-  FIBITMAP* bitmap32 = FreeImage_ConvertTo32Bits(bitmap);
-  int width = FreeImage_GetWidth(bitmap32);
-  int height = FreeImage_GetHeight(bitmap32);
+  int width = FreeImage_GetWidth(bitmap);
+  int height = FreeImage_GetHeight(bitmap);
   if (width == 0 || height == 0) {
-    std::cerr << "Error: Invalid image dimensions!" << std::endl;
-    exit(1);
+    FreeImage_Unload(bitmap);
+    throw std::runtime_error("Invalid image dimensions in " + name);
   }
-  pixelData.resize(height, std::vector<Color>(width));
+  pixelData.reshape(width, height);
 
-  BYTE* bits = FreeImage_GetBits(bitmap32);
-  unsigned int pitch = FreeImage_GetPitch(bitmap32);
+  BYTE* bits = FreeImage_GetBits(bitmap);
+  unsigned int pitch = FreeImage_GetPitch(bitmap);
+  int bytesPerPixel = FreeImage_GetBPP(bitmap) / 8;
   for (int i = 0; i < height; i++) {
-    for (int j = 0; j < width; j++) {
-      int index = i * pitch + j * 4;
-      pixelData[i][j].r = bits[index + 2];
-      pixelData[i][j].g = bits[index + 1];
-      pixelData[i][j].b = bits[index + 0];
+    const BYTE* src = bits + static_cast<size_t>(i) * pitch;
+    uint8_t* r = pixelData.row(0, i);
+    uint8_t* g = pixelData.row(1, i);
+    uint8_t* b = pixelData.row(2, i);
+    for (int j = 0; j < width; j++, src += bytesPerPixel) {
+      r[j] = src[FI_RGBA_RED];
+      g[j] = src[FI_RGBA_GREEN];
+      b[j] = src[FI_RGBA_BLUE];
     }
   }
-  FreeImage_Unload(bitmap32);
   FreeImage_Unload(bitmap);
-  FreeImage_DeInitialise();
+}
+
+OutputFormat outputFormatFor(const std::string& path) {
+  return QtcCodec::isQtcPath(path) ? OutputFormat::Qtc : OutputFormat::Jpeg;
+}
+
+// Decode data into a new bitmap. A .qtc stream is recognised by its header,
+// anything else by FreeImage.
+FIBITMAP* decodeBitmap(const std::vector<uint8_t>& data,
+                       const std::string& name) {
+  QtcHeader header;
+  FIBITMAP* bitmap = nullptr;
+  if (QtcCodec::readHeader(data.data(), data.size(), header)) {
+    bitmap = decodeQtc(data.data(), data.size());
+  } else {
+    FIMEMORY* stream = FreeImage_OpenMemory(const_cast<BYTE*>(data.data()),
+                                            static_cast<DWORD>(data.size()));
+    FREE_IMAGE_FORMAT format = FreeImage_GetFileTypeFromMemory(stream, 0);
+    if (format != FIF_UNKNOWN)
+      bitmap = FreeImage_LoadFromMemory(format, stream, JPEG_DEFAULT);
+    FreeImage_CloseMemory(stream);
+  }
+  if (!bitmap) throw std::runtime_error("Cannot decode " + name);
+  return bitmap;
+}
+
+void decodeImage(const std::vector<uint8_t>& data, Image& pixels,
+                 const std::string& name) {
+  copyBitmap(decodeBitmap(data, name), pixels, name);
+}
+
+// Decode the image at path into planar RGB and return the file's size.
+// The file's bytes are dropped once the bitmap is decoded, so an
+// uncompressed input is held twice at most, not three times. Throws
+// std::runtime_error if it cannot be read, so a caller processing many
+// images can skip just this one.
+long long loadImage(const std::string& path, Image& pixels) {
+  std::vector<uint8_t> data = readFile(path);
+  long long size = static_cast<long long>(data.size());
+  FIBITMAP* bitmap = decodeBitmap(data, path);
+  data = std::vector<uint8_t>();
+  copyBitmap(bitmap, pixels, path);
+  return size;
+}
+
+Image loadImage(const std::string& path) {
+  Image pixelData;
+  loadImage(path, pixelData);
+  return pixelData;
+}
+
+// Append the JPEG of the bitmap to out.
+void encodeJpeg(FIBITMAP* bitmap, std::vector<uint8_t>& out) {
+  FIMEMORY* stream = FreeImage_OpenMemory();
+  BYTE* data = nullptr;
+  DWORD size = 0;
+  bool saved = FreeImage_SaveToMemory(FIF_JPEG, bitmap, stream,
+                                      JPEG_QUALITYGOOD) &&
+               FreeImage_AcquireMemory(stream, &data, &size);
+  if (saved) out.insert(out.end(), data, data + size);
+  FreeImage_CloseMemory(stream);
+  if (!saved) throw std::runtime_error("Failed to encode JPEG");
+}
+
+void encodeTree(Quadtree& tree, OutputFormat format,
+                std::vector<uint8_t>& out, int threadCount) {
+  out.clear();
+  if (format == OutputFormat::Qtc) {
+    QtcCodec::encode(tree, out);
+    return;
+  }
+  FIBITMAP* bitmap =
+      tree.createImage(std::numeric_limits<int>::max(), false, threadCount);
+  if (!bitmap) throw std::runtime_error("Cannot allocate bitmap");
+  try {
+    encodeJpeg(bitmap, out);
+  } catch (...) {
+    FreeImage_Unload(bitmap);
+    throw;
+  }
+  FreeImage_Unload(bitmap);
+}
+
+// Load image from the input path and populate pixelData. The input's size is
+// taken from the bytes read.
+void ImageCompressor::loadImageFromPath() {
+  bytes.input = loadImage(inputImagePath, pixelData);
 }
 
 // Get user input for paths, error method, threshold, block size, and target
-// compression.
+// compression. Invalid input throws std::runtime_error.
 void ImageCompressor::getInput() {
   std::cout << "Enter the absolute path of the image to compress: ";
   std::getline(std::cin, inputImagePath);
   if (inputImagePath.empty()) {
-    std::cerr << "Error: Image path cannot be empty!\n";
-    exit(1);
+    throw std::runtime_error("Image path cannot be empty!");
   }
 
   std::cout << "Choose error calculation method (1: Variance, 2: MAD, 3: Max "
-               "Pixel Difference, 4: Entropy, 5: SSIM): ";
-  if (!(std::cin >> errorMethod) || (errorMethod < 1 || errorMethod > 5)) {
-    std::cerr << "Error: Invalid error method!\n";
-    exit(1);
+               "Pixel Difference, 4: Entropy, 5: SSIM, 6: SSIM per channel): ";
+  if (!(std::cin >> errorMethod) || (errorMethod < 1 || errorMethod > 6)) {
+    throw std::runtime_error("Invalid error method!");
   }
 
   std::cout << "Enter threshold value: ";
   if (!(std::cin >> threshold) || threshold < 0) {
-    std::cerr << "Error: Threshold must be non-negative!\n";
-    exit(1);
+    throw std::runtime_error("Threshold must be non-negative!");
   }
 
   std::cout << "Enter minimum block size: ";
   if (!(std::cin >> minBlockSize) || minBlockSize <= 0) {
-    std::cerr << "Error: Minimum block size must be greater than 0!\n";
-    exit(1);
+    throw std::runtime_error("Minimum block size must be greater than 0!");
   }
 
   std::cout << "Enter target compression ratio (1.0 = 100%, 0 to disable): ";
   if (!(std::cin >> targetCompression) || targetCompression < 0 ||
       targetCompression > 1.0) {
-    std::cerr << "Error: Target compression must be between 0 and 1.0!\n";
-    exit(1);
+    throw std::runtime_error("Target compression must be between 0 and 1.0!");
   }
 
   std::cin.ignore();
   std::cout << "Enter the absolute path for the compressed image: ";
   std::getline(std::cin, outputImagePath);
   if (outputImagePath.empty()) {
-    std::cerr << "Error: Output path cannot be empty!\n";
-    exit(1);
+    throw std::runtime_error("Output path cannot be empty!");
   }
 
   std::cout << "Enter the absolute path for the GIF file (optional): ";
   std::getline(std::cin, gifPath);
 }
 
-// Process image: load image, build quadtree, and measure execution time.
+// Process image: load image, build quadtree, and measure execution time. With
+// a target compression the tree is built once down to minBlockSize and the
+// threshold is then searched on that cached tree.
 void ImageCompressor::processImage() {
-  loadImageFromPath();
+  {
+    ScopedPhase phase(stats, "decode");
+    loadImageFromPath();
+  }
 
   auto start = std::chrono::high_resolution_clock::now();
 
-  quadtree = new Quadtree(pixelData, threshold, getMetric(), minBlockSize);
+  double buildThreshold = targetCompression > 0
+                              ? -std::numeric_limits<double>::infinity()
+                              : threshold;
+  {
+    ScopedPhase phase(stats, "build");
+    metric = createMetric(errorMethod);
+    // The search prunes the tree by its errors.
+    BuildOptions options = buildOptions;
+    options.exactErrors = targetCompression > 0;
+    quadtree = new Quadtree(pixelData.view(), buildThreshold, metric.get(),
+                            minBlockSize, options);
+  }
+  if (targetCompression > 0) {
+    ScopedPhase phase(stats, "search");
+    searchTargetCompression();
+  }
 
   auto end = std::chrono::high_resolution_clock::now();
   execTime = end - start;
 }
 
-// Return a new Metric instance based on the chosen error method.
-Metric* ImageCompressor::getMetric() {
+// Binary-search the threshold whose output lands closest to the target
+// compression. Every candidate only re-prunes the cached tree and encodes it
+// into a reused buffer; higher thresholds split fewer blocks and compress
+// more. The tree is left pruned at the chosen threshold, and the best
+// candidate's bytes are kept so the caller need not encode it again.
+TargetSearch findTargetThreshold(Quadtree& tree, double inputBytes,
+                                 double target, OutputFormat format,
+                                 int threadCount) {
+  std::vector<float> candidates = tree.getSplitErrors();
+  auto thresholdAt = [&](size_t i) -> double {
+    return i < candidates.size() ? candidates[i]
+                                 : std::numeric_limits<double>::infinity();
+  };
+  std::vector<uint8_t> candidate;
+  auto compressionAt = [&](size_t i) -> double {
+    tree.prune(thresholdAt(i));
+    try {
+      encodeTree(tree, format, candidate, threadCount);
+    } catch (const std::runtime_error&) {
+      return std::nan("");
+    }
+    return 1.0 - candidate.size() / inputBytes;
+  };
+
+  size_t lo = 0, hi = candidates.size(), best = hi;
+  TargetSearch result{0, std::nan(""), 0, std::vector<uint8_t>()};
+  while (lo <= hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    double compression = compressionAt(mid);
+    result.encodes++;
+    if (std::isnan(compression)) break;
+    double miss = std::abs(compression - target);
+    if (std::isnan(result.compression) ||
+        miss < std::abs(result.compression - target)) {
+      best = mid;
+      result.compression = compression;
+      result.encoded.swap(candidate);
+    }
+    if (miss < 0.001) break;
+    if (compression >= target) {
+      if (mid == 0) break;
+      hi = mid - 1;
+    } else {
+      lo = mid + 1;
+    }
+  }
+
+  result.threshold = thresholdAt(best);
+  tree.prune(result.threshold);
+  return result;
+}
+
+// Build the tree and search the threshold for the entered target compression.
+void ImageCompressor::searchTargetCompression() {
+  TargetSearch result =
+      findTargetThreshold(*quadtree, bytes.input, targetCompression,
+                          outputFormatFor(outputImagePath),
+                          buildOptions.threadCount);
+  threshold = result.threshold;
+  encoded.swap(result.encoded);
+  printf("[INFO] Target Compression: threshold %.4f gives %.2f%% "
+         "(%d encodes)\n",
+         threshold, result.compression * 100, result.encodes);
+}
+
+// Create the metric for an error method number as listed in the prompt.
+std::unique_ptr<Metric> createMetric(int errorMethod) {
   switch (errorMethod) {
     case 1:
-      return new VarianceMetric();
+      return std::unique_ptr<Metric>(new VarianceMetric());
     case 2:
-      return new MADMetric();
+      return std::unique_ptr<Metric>(new MADMetric());
     case 3:
-      return new MaxPixelDifferenceMetric();
+      return std::unique_ptr<Metric>(new MaxPixelDifferenceMetric());
     case 4:
-      return new EntropyMetric();
+      return std::unique_ptr<Metric>(new EntropyMetric());
     case 5:
-      return new SSIMetric(threshold);
+      return std::unique_ptr<Metric>(new SSIMetric());
+    case 6:
+      return std::unique_ptr<Metric>(new SSIMetric(true));
     default:
-      return new VarianceMetric();
+      return std::unique_ptr<Metric>(new VarianceMetric());
   }
 }
 
-// Save the compressed image to the output path.
+// Encode the compressed image in memory, as .qtc if the output path asks for
+// it and as JPEG otherwise, then write it. A target search has already
+// encoded it.
 void ImageCompressor::saveImage() {
-  int width = pixelData[0].size();
-  int height = pixelData.size();
-  bool drawOutline = false;
-
-  FreeImage_Initialise();
-  FIBITMAP* bitmap = FreeImage_Allocate(width, height, 24);
-  if (!bitmap) {
-    std::cerr << "Error: Cannot allocate bitmap." << std::endl;
-    FreeImage_DeInitialise();
-    return;
-  }
-
-  std::function<void(QuadtreeNode*)> drawNode = [&](QuadtreeNode* node) {
-    if (node->isLeaf) {
-      for (int y = node->y; y < node->y + node->height; y++) {
-        for (int x = node->x; x < node->x + node->width; x++) {
-          RGBQUAD col;
-          col.rgbRed = node->color.r;
-          col.rgbGreen = node->color.g;
-          col.rgbBlue = node->color.b;
-          FreeImage_SetPixelColor(bitmap, x, y, &col);
-        }
-      }
-      if (drawOutline) {
-        RGBQUAD outline = {0, 0, 0, 0};
-        for (int x = node->x; x < node->x + node->width; x++)
-          FreeImage_SetPixelColor(bitmap, x, node->y, &outline);
-        for (int x = node->x; x < node->x + node->width; x++)
-          FreeImage_SetPixelColor(bitmap, x, node->y + node->height - 1,
-                                  &outline);
-        for (int y = node->y; y < node->y + node->height; y++)
-          FreeImage_SetPixelColor(bitmap, node->x, y, &outline);
-        for (int y = node->y; y < node->y + node->height; y++)
-          FreeImage_SetPixelColor(bitmap, node->x + node->width - 1, y,
-                                  &outline);
+  OutputFormat format = outputFormatFor(outputImagePath);
+  try {
+    if (encoded.empty() && format == OutputFormat::Jpeg) {
+      FIBITMAP* bitmap;
+      {
+        ScopedPhase phase(stats, "rasterize");
+        bitmap = quadtree->createImage(std::numeric_limits<int>::max(), false,
+                                       buildOptions.threadCount);
       }
-    } else {
-      for (int i = 0; i < 4; i++) {
-        if (node->children[i] != nullptr) drawNode(node->children[i]);
+      if (!bitmap) throw std::runtime_error("Cannot allocate bitmap.");
+      ScopedPhase phase(stats, "encode");
+      try {
+        encodeJpeg(bitmap, encoded);
+      } catch (...) {
+        FreeImage_Unload(bitmap);
+        throw;
       }
+      FreeImage_Unload(bitmap);
+    } else if (encoded.empty()) {
+      ScopedPhase phase(stats, "encode");
+      QtcCodec::encode(*quadtree, encoded);
     }
-  };
-
-  drawNode(quadtree->getRoot());
-
-  if (!FreeImage_Save(FIF_JPEG, bitmap, outputImagePath.c_str(),
-                      JPEG_QUALITYGOOD)) {
-    std::cerr << "Error: Failed to save the image as JPG." << std::endl;
-  } else {
-    std::cout << "[OUTPUT] Compressed image saved at: " << outputImagePath
-              << std::endl;
+    ScopedPhase phase(stats, "write");
+    writeFile(encoded, outputImagePath);
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return;
   }
-  FreeImage_Unload(bitmap);
-  FreeImage_DeInitialise();
+  bytes.output = static_cast<long long>(encoded.size());
+  std::cout << "[OUTPUT] Compressed image saved at: " << outputImagePath
+            << std::endl;
 }
 
-// Save a GIF animation of the compression process using ImageMagick.
+// Save a GIF animation of the compression process, one frame per depth. The
+// GIF path is optional, so nothing is written without one.
 void ImageCompressor::saveGif() {
-  int maxDepth = quadtree->getTreeDepth();
-  std::vector<std::string> frameFilenames;
-  auto isFileExist = [&](const std::string& filename) -> bool {
-    struct stat buffer;
-    return (stat(filename.c_str(), &buffer) == 0);
-  };
-
-  for (int depth = 0; depth <= maxDepth; depth++) {
-    FIBITMAP* frameBitmap = quadtree->createImage(depth, true);
-    if (!frameBitmap) {
-      std::cerr << "Error: Failed to create image for depth " << depth
-                << std::endl;
-      continue;
-    }
-    std::ostringstream oss;
-    oss << "frame_" << depth << ".png";
-    std::string frameFile = oss.str();
-    frameFilenames.push_back(frameFile);
-
-    if (!FreeImage_Save(FIF_PNG, frameBitmap, frameFile.c_str(), 0)) {
-      std::cerr << "Error: Failed to save frame " << depth << std::endl;
-    }
-    FreeImage_Unload(frameBitmap);
-  }
-
-  std::ostringstream cmd;
-  cmd << "convert -delay 50 -loop 0";
-  for (const auto& frame : frameFilenames) {
-    if (isFileExist(frame))
-      cmd << " " << frame;
-    else
-      std::cerr << "Warning: Frame file " << frame << " does not exist."
-                << std::endl;
-  }
-  cmd << " " << gifPath;
-
-  int ret = system(cmd.str().c_str());
-  if (ret != 0) {
-    std::cerr << "Error: Failed to create GIF using ImageMagick. Command: "
-              << cmd.str() << std::endl;
-  }
-
-  for (const auto& frame : frameFilenames) {
-    if (isFileExist(frame)) {
-      if (std::remove(frame.c_str()) != 0)
-        std::cerr << "Error: Failed to remove temporary frame " << frame
-                  << std::endl;
-    }
+  if (gifPath.empty()) return;
+  const int frameDelay = 50;  // hundredths of a second
+  ScopedPhase phase(stats, "gif");
+  if (!saveQuadtreeGif(*quadtree, gifPath, frameDelay, true,
+                       buildOptions.threadCount)) {
+    std::cerr << "Error: Failed to write GIF to " << gifPath << std::endl;
+    return;
   }
   std::cout << "[OUTPUT] GIF saved at: " << gifPath << std::endl;
 }
 
+const double kBytesPerMB = 1024.0 * 1024.0;
+
 void ImageCompressor::showStats() {
   printf("[INFO] Max Depth: %d\n", quadtree->getTreeDepth());
+  printf("[INFO] Nodes: %lld (%lld leaves)\n", quadtree->getNodeCount(),
+         quadtree->getLeafCount());
   printf("[INFO] Execution Time: %.2f sec\n", execTime.count());
-  printf("[INFO] Original File Size: %.2f MB\n",
-         getFileSizeInMB(inputImagePath));
-  printf("[INFO] Compressed File Size: %.2f MB\n",
-         getFileSizeInMB(outputImagePath));
+  printf("[INFO] Original File Size: %.2f MB\n", bytes.input / kBytesPerMB);
+  printf("[INFO] Compressed File Size: %.2f MB\n", bytes.output / kBytesPerMB);
 
   double compressPercentage =
-      (1 - getFileSizeInMB(outputImagePath) / getFileSizeInMB(inputImagePath)) *
-      100;
+      (1 - static_cast<double>(bytes.output) / bytes.input) * 100;
   printf("[INFO] Compression Percentage: %.2f%%\n", compressPercentage);
 }
 
+// Write the phase timings and tree statistics of this run as JSON, if a
+// stats path was set.
+void ImageCompressor::writeStats() {
+  if (statsPath.empty()) return;
+  stats.set("input", inputImagePath);
+  stats.set("output", outputImagePath);
+  stats.set("metric", errorMethod);
+  stats.set("threshold", threshold);
+  stats.set("min_block_size", minBlockSize);
+  stats.set("target_compression", targetCompression);
+  stats.set("width", pixelData.getWidth());
+  stats.set("height", pixelData.getHeight());
+  stats.set("input_bytes", static_cast<double>(bytes.input));
+  stats.set("output_bytes", static_cast<double>(bytes.output));
+  stats.addTree(*quadtree);
+
+  std::ofstream file(statsPath);
+  file << stats.toJson() << std::endl;
+  if (!file) {
+    std::cerr << "Error: Failed to write stats to " << statsPath << std::endl;
+    return;
+  }
+  std::cout << "[OUTPUT] Stats saved at: " << statsPath << std::endl;
+}
+
 // Run the complete image compression process.
 void ImageCompressor::run() {
   getInput();
+  // One pool serves the build, every render of the search, the output and
+  // the GIF.
+  std::unique_ptr<ThreadPool> pool;
+  if (buildOptions.threadCount > 1) {
+    pool.reset(new ThreadPool(buildOptions.threadCount));
+    buildOptions.pool = pool.get();
+  }
   processImage();
   printf("----------------- [ STATS ] -----------------\n");
   saveImage();
   saveGif();
   showStats();
+  writeStats();
   delete quadtree;
+  buildOptions.pool = nullptr;
 }
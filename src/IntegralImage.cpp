@@ -0,0 +1,145 @@
+#include "IntegralImage.hpp"
+
+#include <climits>
+#include <cmath>
+
+namespace {
+
+// Largest value one pixel adds to a 32-bit table, by the square sums kept.
+const long long kMaxChannel = 255;
+const long long kMaxSquareTotal = 3 * 255 * 255;
+const long long kMaxSquare = 255 * 255;
+
+int pieceSideFor(long long area) {
+  int side = static_cast<int>(std::sqrt(static_cast<double>(area)));
+  while (static_cast<long long>(side) * side > area) side--;
+  return side;
+}
+
+// Pieces of at most this many pixels read the channel sums without wrapping.
+const long long kSumPieceArea = UINT32_MAX / kMaxChannel;
+const int kSumPieceSide = pieceSideFor(kSumPieceArea);
+
+}  // namespace
+
+IntegralImage::IntegralImage()
+    : width(0),
+      height(0),
+      squares(SquareSums::None),
+      pieceArea(kSumPieceArea),
+      pieceSide(kSumPieceSide) {}
+
+IntegralImage::IntegralImage(const ImageView& image, SquareSums squares) {
+  build(image, squares);
+}
+
+// Build the summed-area tables in one pass over the image. Squares are only
+// accumulated when a metric needs them, which saves one to three tables
+// otherwise. assign() keeps the capacity of every table, so rebuilding for
+// an image no larger than the last one allocates nothing.
+void IntegralImage::build(const ImageView& image, SquareSums squares) {
+  width = image.getWidth();
+  height = image.getHeight();
+  this->squares = squares;
+  // Squared luma is 64-bit and never limits the pieces before the sums do.
+  long long maxPixel = squares == SquareSums::Total        ? kMaxSquareTotal
+                       : squares == SquareSums::PerChannel ? kMaxSquare
+                                                           : kMaxChannel;
+  pieceArea = UINT32_MAX / maxPixel;
+  pieceSide = pieceSideFor(pieceArea);
+  size_t cells = static_cast<size_t>(width + 1) * (height + 1);
+  for (int c = 0; c < 3; c++) sum[c].assign(cells, 0);
+  if (squares == SquareSums::Total) sumSq.assign(cells, 0);
+  if (squares == SquareSums::Luma) lumaSq.assign(cells, 0);
+  if (squares == SquareSums::PerChannel)
+    for (int c = 0; c < 3; c++) channelSq[c].assign(cells, 0);
+
+  for (int i = 0; i < height; i++) {
+    const uint8_t* r = image.row(0, i);
+    const uint8_t* g = image.row(1, i);
+    const uint8_t* b = image.row(2, i);
+    uint32_t rowR = 0, rowG = 0, rowB = 0, rowSq = 0;
+    uint32_t rowSqR = 0, rowSqG = 0, rowSqB = 0;
+    uint64_t rowLuma = 0;
+    for (int j = 0; j < width; j++) {
+      rowR += r[j];
+      rowG += g[j];
+      rowB += b[j];
+      size_t above = index(j + 1, i), here = index(j + 1, i + 1);
+      sum[0][here] = sum[0][above] + rowR;
+      sum[1][here] = sum[1][above] + rowG;
+      sum[2][here] = sum[2][above] + rowB;
+      if (squares == SquareSums::Total) {
+        rowSq += r[j] * r[j] + g[j] * g[j] + b[j] * b[j];
+        sumSq[here] = sumSq[above] + rowSq;
+      } else if (squares == SquareSums::Luma) {
+        uint64_t luma = 299 * r[j] + 587 * g[j] + 114 * b[j];
+        rowLuma += luma * luma;
+        lumaSq[here] = lumaSq[above] + rowLuma;
+      } else if (squares == SquareSums::PerChannel) {
+        rowSqR += r[j] * r[j];
+        rowSqG += g[j] * g[j];
+        rowSqB += b[j] * b[j];
+        channelSq[0][here] = channelSq[0][above] + rowSqR;
+        channelSq[1][here] = channelSq[1][above] + rowSqG;
+        channelSq[2][here] = channelSq[2][above] + rowSqB;
+      }
+    }
+  }
+}
+
+// Read the sums of the block at (x, y) with the given size.
+BlockSums IntegralImage::query(int x, int y, int w, int h) const {
+  BlockSums s = {};
+  s.count = static_cast<long long>(w) * h;
+  forEachPiece(x, y, w, h, pieceArea, pieceSide,
+               [&](int px, int py, int pw, int ph) {
+                 for (int c = 0; c < 3; c++)
+                   s.sum[c] += rect(sum[c], px, py, pw, ph);
+                 if (squares == SquareSums::Total) {
+                   s.sumSq += rect(sumSq, px, py, pw, ph);
+                 } else if (squares == SquareSums::Luma) {
+                   s.lumaSq += rect(lumaSq, px, py, pw, ph);
+                 } else if (squares == SquareSums::PerChannel) {
+                   for (int c = 0; c < 3; c++)
+                     s.channelSq[c] += rect(channelSq[c], px, py, pw, ph);
+                 }
+               });
+  if (squares == SquareSums::PerChannel)
+    s.sumSq = s.channelSq[0] + s.channelSq[1] + s.channelSq[2];
+  return s;
+}
+
+// Average color of the block, truncated towards zero like the pixel scan it
+// replaces.
+Color IntegralImage::average(int x, int y, int w, int h) const {
+  long long count = static_cast<long long>(w) * h;
+  if (count == 0) return Color{0, 0, 0};
+  uint64_t total[3] = {0, 0, 0};
+  forEachPiece(x, y, w, h, kSumPieceArea, kSumPieceSide,
+               [&](int px, int py, int pw, int ph) {
+                 for (int c = 0; c < 3; c++)
+                   total[c] += rect(sum[c], px, py, pw, ph);
+               });
+  return Color{static_cast<int>(total[0] / count),
+               static_cast<int>(total[1] / count),
+               static_cast<int>(total[2] / count)};
+}
+
+// Sum of the per-channel variances of the block. The numerator
+// n * sum(p^2) - sum(p)^2 is formed in 128-bit integers so large flat blocks
+// do not cancel catastrophically in floating point.
+double IntegralImage::variance(int x, int y, int w, int h) const {
+  BlockSums s = query(x, y, w, h);
+  return variance(s.count, s.sum, s.sumSq);
+}
+
+double IntegralImage::variance(long long count, const uint64_t sum[3],
+                               uint64_t sumSq) {
+  unsigned __int128 n = static_cast<unsigned __int128>(count);
+  unsigned __int128 squares = n * sumSq;
+  for (int c = 0; c < 3; c++)
+    squares -= static_cast<unsigned __int128>(sum[c]) * sum[c];
+  return static_cast<double>(squares) /
+         (static_cast<double>(count) * count);
+}
@@ -0,0 +1,100 @@
+#include "MappedImage.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <climits>
+#include <stdexcept>
+
+namespace {
+
+// Read the next unsigned header field, skipping whitespace and comments.
+long long headerField(const uint8_t* data, size_t size, size_t& pos) {
+  for (;;) {
+    while (pos < size && std::isspace(data[pos])) pos++;
+    if (pos < size && data[pos] == '#') {
+      while (pos < size && data[pos] != '\n') pos++;
+      continue;
+    }
+    break;
+  }
+  if (pos >= size || !std::isdigit(data[pos])) return -1;
+  long long value = 0;
+  while (pos < size && std::isdigit(data[pos]) && value <= INT_MAX)
+    value = value * 10 + (data[pos++] - '0');
+  return value;
+}
+
+}  // namespace
+
+MappedImage::MappedImage(const std::string& path)
+    : fd(-1), map(nullptr), mapSize(0), dataOffset(0), width(0), height(0) {
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("Cannot open " + path);
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("Cannot read " + path);
+  }
+  mapSize = static_cast<size_t>(info.st_size);
+  void* address = mmap(nullptr, mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  if (address == MAP_FAILED) {
+    close(fd);
+    throw std::runtime_error("Cannot map " + path);
+  }
+  map = static_cast<uint8_t*>(address);
+
+  size_t pos = 2;
+  long long w = -1, h = -1, maxValue = -1;
+  if (mapSize > 2 && map[0] == 'P' && map[1] == '6') {
+    w = headerField(map, mapSize, pos);
+    h = headerField(map, mapSize, pos);
+    maxValue = headerField(map, mapSize, pos);
+  }
+  // A single whitespace byte separates the header from the pixels.
+  dataOffset = pos + 1;
+  if (w <= 0 || h <= 0 || w > INT_MAX || h > INT_MAX || maxValue != 255 ||
+      dataOffset > mapSize ||
+      (mapSize - dataOffset) / 3 / static_cast<size_t>(w) <
+          static_cast<size_t>(h)) {
+    munmap(map, mapSize);
+    close(fd);
+    throw std::runtime_error(path + " is not a complete 8-bit binary PPM");
+  }
+  width = static_cast<int>(w);
+  height = static_cast<int>(h);
+}
+
+MappedImage::~MappedImage() {
+  munmap(map, mapSize);
+  close(fd);
+}
+
+void MappedImage::copyBlock(const Block& block, Image& out) const {
+  if (out.getWidth() != block.width || out.getHeight() != block.height)
+    out = Image(block.width, block.height);
+  for (int i = 0; i < block.height; i++) {
+    const uint8_t* source = fileRow(block.y + i) + block.x * size_t(3);
+    uint8_t* r = out.row(0, i);
+    uint8_t* g = out.row(1, i);
+    uint8_t* b = out.row(2, i);
+    for (int j = 0; j < block.width; j++) {
+      r[j] = source[3 * j];
+      g[j] = source[3 * j + 1];
+      b[j] = source[3 * j + 2];
+    }
+  }
+}
+
+void MappedImage::release(const Block& block) const {
+  // The block's top row comes first in the file.
+  const uint8_t* first = fileRow(block.y + block.height - 1);
+  const uint8_t* last = fileRow(block.y) + static_cast<size_t>(width) * 3;
+  uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  uintptr_t start = reinterpret_cast<uintptr_t>(first) & ~(page - 1);
+  madvise(reinterpret_cast<void*>(start),
+          reinterpret_cast<uintptr_t>(last) - start, MADV_DONTNEED);
+}
@@ -0,0 +1,309 @@
+#include "MetricKernels.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define METRIC_KERNELS_X86 1
+#endif
+
+namespace MetricKernels {
+
+namespace {
+
+void minMaxScalar(const uint8_t* row, int n, uint8_t& lo, uint8_t& hi) {
+  for (int i = 0; i < n; i++) {
+    lo = std::min(lo, row[i]);
+    hi = std::max(hi, row[i]);
+  }
+}
+
+void absDiffScalar(const uint8_t* row, int n, uint8_t k, uint64_t& sad,
+                   uint64_t& above) {
+  for (int i = 0; i < n; i++) {
+    sad += row[i] > k ? row[i] - k : k - row[i];
+    above += row[i] > k;
+  }
+}
+
+#ifdef METRIC_KERNELS_X86
+
+// Fold the byte lanes of a min/max accumulator into lo/hi.
+void foldLanes(const uint8_t* lanesLo, const uint8_t* lanesHi, int lanes,
+               uint8_t& lo, uint8_t& hi) {
+  for (int i = 0; i < lanes; i++) {
+    lo = std::min(lo, lanesLo[i]);
+    hi = std::max(hi, lanesHi[i]);
+  }
+}
+
+__attribute__((target("sse2"))) void minMaxSse2(const uint8_t* row, int n,
+                                                uint8_t& lo, uint8_t& hi) {
+  int i = 0;
+  if (n >= 16) {
+    __m128i vlo = _mm_set1_epi8(static_cast<char>(lo));
+    __m128i vhi = _mm_set1_epi8(static_cast<char>(hi));
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      vlo = _mm_min_epu8(vlo, v);
+      vhi = _mm_max_epu8(vhi, v);
+    }
+    alignas(16) uint8_t bufLo[16], bufHi[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(bufLo), vlo);
+    _mm_store_si128(reinterpret_cast<__m128i*>(bufHi), vhi);
+    foldLanes(bufLo, bufHi, 16, lo, hi);
+  }
+  minMaxScalar(row + i, n - i, lo, hi);
+}
+
+// SAD against a broadcast k gives sum(|p - k|); min(p -sat k, 1) is 1
+// exactly where p > k, and a second SAD against zero counts those lanes.
+__attribute__((target("sse2"))) void absDiffSse2(const uint8_t* row, int n,
+                                                 uint8_t k, uint64_t& sad,
+                                                 uint64_t& above) {
+  int i = 0;
+  if (n >= 16) {
+    const __m128i vk = _mm_set1_epi8(static_cast<char>(k));
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i accSad = zero, accAbove = zero;
+    for (; i + 16 <= n; i += 16) {
+      __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+      accSad = _mm_add_epi64(accSad, _mm_sad_epu8(v, vk));
+      __m128i gt = _mm_min_epu8(_mm_subs_epu8(v, vk), ones);
+      accAbove = _mm_add_epi64(accAbove, _mm_sad_epu8(gt, zero));
+    }
+    alignas(16) uint64_t bufSad[2], bufAbove[2];
+    _mm_store_si128(reinterpret_cast<__m128i*>(bufSad), accSad);
+    _mm_store_si128(reinterpret_cast<__m128i*>(bufAbove), accAbove);
+    sad += bufSad[0] + bufSad[1];
+    above += bufAbove[0] + bufAbove[1];
+  }
+  absDiffScalar(row + i, n - i, k, sad, above);
+}
+
+__attribute__((target("avx2"))) void minMaxAvx2(const uint8_t* row, int n,
+                                                uint8_t& lo, uint8_t& hi) {
+  int i = 0;
+  if (n >= 32) {
+    __m256i vlo = _mm256_set1_epi8(static_cast<char>(lo));
+    __m256i vhi = _mm256_set1_epi8(static_cast<char>(hi));
+    for (; i + 32 <= n; i += 32) {
+      __m256i v =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+      vlo = _mm256_min_epu8(vlo, v);
+      vhi = _mm256_max_epu8(vhi, v);
+    }
+    alignas(32) uint8_t bufLo[32], bufHi[32];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bufLo), vlo);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bufHi), vhi);
+    foldLanes(bufLo, bufHi, 32, lo, hi);
+  }
+  minMaxSse2(row + i, n - i, lo, hi);
+}
+
+__attribute__((target("avx2"))) void absDiffAvx2(const uint8_t* row, int n,
+                                                 uint8_t k, uint64_t& sad,
+                                                 uint64_t& above) {
+  int i = 0;
+  if (n >= 32) {
+    const __m256i vk = _mm256_set1_epi8(static_cast<char>(k));
+    const __m256i ones = _mm256_set1_epi8(1);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i accSad = zero, accAbove = zero;
+    for (; i + 32 <= n; i += 32) {
+      __m256i v =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + i));
+      accSad = _mm256_add_epi64(accSad, _mm256_sad_epu8(v, vk));
+      __m256i gt = _mm256_min_epu8(_mm256_subs_epu8(v, vk), ones);
+      accAbove = _mm256_add_epi64(accAbove, _mm256_sad_epu8(gt, zero));
+    }
+    alignas(32) uint64_t bufSad[4], bufAbove[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bufSad), accSad);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(bufAbove), accAbove);
+    for (int lane = 0; lane < 4; lane++) {
+      sad += bufSad[lane];
+      above += bufAbove[lane];
+    }
+  }
+  absDiffSse2(row + i, n - i, k, sad, above);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void minMaxAvx512(
+    const uint8_t* row, int n, uint8_t& lo, uint8_t& hi) {
+  int i = 0;
+  if (n >= 64) {
+    __m512i vlo = _mm512_set1_epi8(static_cast<char>(lo));
+    __m512i vhi = _mm512_set1_epi8(static_cast<char>(hi));
+    for (; i + 64 <= n; i += 64) {
+      __m512i v = _mm512_loadu_si512(row + i);
+      vlo = _mm512_min_epu8(vlo, v);
+      vhi = _mm512_max_epu8(vhi, v);
+    }
+    alignas(64) uint8_t bufLo[64], bufHi[64];
+    _mm512_store_si512(bufLo, vlo);
+    _mm512_store_si512(bufHi, vhi);
+    foldLanes(bufLo, bufHi, 64, lo, hi);
+  }
+  minMaxAvx2(row + i, n - i, lo, hi);
+}
+
+__attribute__((target("avx512f,avx512bw"))) void absDiffAvx512(
+    const uint8_t* row, int n, uint8_t k, uint64_t& sad, uint64_t& above) {
+  int i = 0;
+  if (n >= 64) {
+    const __m512i vk = _mm512_set1_epi8(static_cast<char>(k));
+    const __m512i ones = _mm512_set1_epi8(1);
+    const __m512i zero = _mm512_setzero_si512();
+    __m512i accSad = zero, accAbove = zero;
+    for (; i + 64 <= n; i += 64) {
+      __m512i v = _mm512_loadu_si512(row + i);
+      accSad = _mm512_add_epi64(accSad, _mm512_sad_epu8(v, vk));
+      __m512i gt = _mm512_min_epu8(_mm512_subs_epu8(v, vk), ones);
+      accAbove = _mm512_add_epi64(accAbove, _mm512_sad_epu8(gt, zero));
+    }
+    alignas(64) uint64_t bufSad[8], bufAbove[8];
+    _mm512_store_si512(bufSad, accSad);
+    _mm512_store_si512(bufAbove, accAbove);
+    for (int lane = 0; lane < 8; lane++) {
+      sad += bufSad[lane];
+      above += bufAbove[lane];
+    }
+  }
+  absDiffAvx2(row + i, n - i, k, sad, above);
+}
+
+#endif  // METRIC_KERNELS_X86
+
+struct KernelSet {
+  void (*minMax)(const uint8_t*, int, uint8_t&, uint8_t&);
+  void (*absDiff)(const uint8_t*, int, uint8_t, uint64_t&, uint64_t&);
+};
+
+KernelSet kernelsFor(Isa isa) {
+  switch (isa) {
+#ifdef METRIC_KERNELS_X86
+    case Isa::AVX512:
+      return {minMaxAvx512, absDiffAvx512};
+    case Isa::AVX2:
+      return {minMaxAvx2, absDiffAvx2};
+    case Isa::SSE2:
+      return {minMaxSse2, absDiffSse2};
+#endif
+    default:
+      return {minMaxScalar, absDiffScalar};
+  }
+}
+
+std::atomic<Isa>& selectedIsa() {
+  static std::atomic<Isa> isa(detectIsa());
+  return isa;
+}
+
+const KernelSet& kernels() {
+  static const KernelSet table[4] = {
+      kernelsFor(Isa::Scalar), kernelsFor(Isa::SSE2), kernelsFor(Isa::AVX2),
+      kernelsFor(Isa::AVX512)};
+  Isa isa = selectedIsa().load(std::memory_order_relaxed);
+  return table[static_cast<int>(isa)];
+}
+
+// h * log2(h) for the small counts that dominate per-block histograms.
+const int kLogTableSize = 4096;
+
+const std::vector<double>& xLog2xTable() {
+  static const std::vector<double> table = [] {
+    std::vector<double> values(kLogTableSize, 0.0);
+    for (int h = 1; h < kLogTableSize; h++) values[h] = h * std::log2(h);
+    return values;
+  }();
+  return table;
+}
+
+}  // namespace
+
+Isa detectIsa() {
+#ifdef METRIC_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+    return Isa::AVX512;
+  if (__builtin_cpu_supports("avx2")) return Isa::AVX2;
+  if (__builtin_cpu_supports("sse2")) return Isa::SSE2;
+#endif
+  return Isa::Scalar;
+}
+
+Isa activeIsa() { return selectedIsa().load(); }
+
+void setIsa(Isa isa) {
+  selectedIsa().store(std::min(isa, detectIsa()));
+}
+
+const char* isaName(Isa isa) {
+  switch (isa) {
+    case Isa::AVX512:
+      return "avx512";
+    case Isa::AVX2:
+      return "avx2";
+    case Isa::SSE2:
+      return "sse2";
+    default:
+      return "scalar";
+  }
+}
+
+void minMaxRow(const uint8_t* row, int n, uint8_t& lo, uint8_t& hi) {
+  kernels().minMax(row, n, lo, hi);
+}
+
+void absDiffRow(const uint8_t* row, int n, uint8_t k, uint64_t& sad,
+                uint64_t& above) {
+  kernels().absDiff(row, n, k, sad, above);
+}
+
+void histogramRow(const uint8_t* row, int n, uint32_t* hist) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    hist[row[i]]++;
+    hist[256 + row[i + 1]]++;
+    hist[512 + row[i + 2]]++;
+    hist[768 + row[i + 3]]++;
+  }
+  for (; i < n; i++) hist[row[i]]++;
+}
+
+// H = log2(n) - sum(h * log2(h)) / n, which only needs h * log2(h) per bin.
+namespace {
+
+template <typename Count>
+double entropyOf(const Count* hist, int bins, long long count) {
+  if (count <= 0) return 0.0;
+  const std::vector<double>& table = xLog2xTable();
+  double weighted = 0.0;
+  for (int i = 0; i < bins; i++) {
+    Count h = hist[i];
+    if (h == 0) continue;
+    weighted += h < static_cast<Count>(kLogTableSize) ? table[h]
+                                                      : h * std::log2(h);
+  }
+  return std::log2(static_cast<double>(count)) - weighted / count;
+}
+
+}  // namespace
+
+double entropy(const uint32_t* hist, long long count) {
+  return entropyOf(hist, 256, count);
+}
+
+double entropy(const uint64_t* hist, long long count) {
+  return entropyOf(hist, 256, count);
+}
+
+double entropyOfBins(const uint32_t* bins, int n, long long count) {
+  return entropyOf(bins, n, count);
+}
+
+}  // namespace MetricKernels
@@ -1,18 +1,25 @@
 #include "Metrics.hpp"
 
+#include "MetricKernels.hpp"
+
 typedef long long ll;
 using namespace std;
 #include <iostream>
 
-double VarianceMetric::compute(const std::vector<std::vector<Color>>& pixels,
-                               int x, int y, int width, int height) {
-  long sumR = 0, sumG = 0, sumB = 0;
-  int count = width * height;
+double VarianceMetric::compute(const ImageView& image, int x, int y, int width,
+                               int height) {
+  if (integral && integral->getSquareSums() == SquareSums::Total)
+    return compute(integral->query(x, y, width, height));
+  long long sumR = 0, sumG = 0, sumB = 0;
+  long long count = static_cast<long long>(width) * height;
   for (int i = y; i < y + height; i++) {
+    const uint8_t* r = image.row(0, i);
+    const uint8_t* g = image.row(1, i);
+    const uint8_t* b = image.row(2, i);
     for (int j = x; j < x + width; j++) {
-      sumR += pixels[i][j].r;
-      sumG += pixels[i][j].g;
-      sumB += pixels[i][j].b;
+      sumR += r[j];
+      sumG += g[j];
+      sumB += b[j];
     }
   }
   double avgR = sumR / (double)count;
@@ -20,129 +27,368 @@ double VarianceMetric::compute(const std::vector<std::vector<Color>>& pixels,
   double avgB = sumB / (double)count;
   double variance = 0.0;
   for (int i = y; i < y + height; i++) {
+    const uint8_t* r = image.row(0, i);
+    const uint8_t* g = image.row(1, i);
+    const uint8_t* b = image.row(2, i);
     for (int j = x; j < x + width; j++) {
-      variance += (pixels[i][j].r - avgR) * (pixels[i][j].r - avgR) +
-                  (pixels[i][j].g - avgG) * (pixels[i][j].g - avgG) +
-                  (pixels[i][j].b - avgB) * (pixels[i][j].b - avgB);
+      variance += (r[j] - avgR) * (r[j] - avgR) +
+                  (g[j] - avgG) * (g[j] - avgG) +
+                  (b[j] - avgB) * (b[j] - avgB);
     }
   }
   return variance / count;
 }
 
-double MADMetric::compute(const std::vector<std::vector<Color>>& pixels, int x,
-                          int y, int width, int height) {
-  long sumR = 0, sumG = 0, sumB = 0;
-  int count = width * height;
-  for (int i = y; i < y + height; i++) {
-    for (int j = x; j < x + width; j++) {
-      sumR += pixels[i][j].r;
-      sumG += pixels[i][j].g;
-      sumB += pixels[i][j].b;
+namespace {
+
+// Rows scanned by an early-exit test are visited coarse to fine: every
+// kRowStride-th row first, then the rows between them, so the rows seen
+// first sample the whole block.
+const int kRowStride = 8;
+
+// Call visit(row) for the rows of [y, y + height) in coarse-to-fine order
+// until it returns true, and return whether it did.
+template <typename Fn>
+bool visitRowsCoarseFirst(int y, int height, Fn visit) {
+  int stride = std::min(kRowStride, height);
+  for (int phase = 0; phase < stride; phase++)
+    for (int i = y + phase; i < y + height; i += stride)
+      if (visit(i)) return true;
+  return false;
+}
+
+// A partial MAD is computed in a different order from the full one, so it
+// only ends a scan once it clears the threshold by more than the rounding
+// of either, including the rounding to float.
+const double kMadMargin = 1e-6;
+
+}  // namespace
+
+void MADMetric::channelSums(const ImageView& image, int x, int y, int width,
+                            int height, uint64_t sums[3]) const {
+  if (integral) {
+    BlockSums s = integral->query(x, y, width, height);
+    for (int c = 0; c < 3; c++) sums[c] = s.sum[c];
+    return;
+  }
+  for (int c = 0; c < 3; c++) {
+    sums[c] = 0;
+    for (int i = y; i < y + height; i++) {
+      const uint8_t* row = image.row(c, i);
+      for (int j = x; j < x + width; j++) sums[c] += row[j];
     }
   }
-  double avgR = sumR / (double)count;
-  double avgG = sumG / (double)count;
-  double avgB = sumB / (double)count;
+}
+
+double MADMetric::compute(const ImageView& image, int x, int y, int width,
+                          int height) {
+  uint64_t sums[3];
+  long long count = static_cast<long long>(width) * height;
+  channelSums(image, x, y, width, height, sums);
+  // With k = floor(avg) and f = avg - k, |p - avg| is |p - k| + f for p <= k
+  // and |p - k| - f for p > k, so one integer SAD pass per channel suffices.
   double mad = 0.0;
-  for (int i = y; i < y + height; i++) {
-    for (int j = x; j < x + width; j++) {
-      mad += std::abs(pixels[i][j].r - avgR) + std::abs(pixels[i][j].g - avgG) +
-             std::abs(pixels[i][j].b - avgB);
-    }
+  for (int c = 0; c < 3; c++) {
+    double avg = sums[c] / (double)count;
+    uint8_t k = static_cast<uint8_t>(avg);
+    double f = avg - k;
+    uint64_t sad = 0, above = 0;
+    for (int i = y; i < y + height; i++)
+      MetricKernels::absDiffRow(image.row(c, i) + x, width, k, sad, above);
+    mad += sad + f * ((double)(count - above) - (double)above);
   }
   return mad / count;
 }
 
-double MaxPixelDifferenceMetric::compute(
-    const std::vector<std::vector<Color>>& pixels, int x, int y, int width,
-    int height) {
-  int minR = 255, minG = 255, minB = 255;
-  int maxR = 0, maxG = 0, maxB = 0;
-  for (int i = y; i < y + height; i++) {
-    for (int j = x; j < x + width; j++) {
-      const Color& c = pixels[i][j];
-      minR = std::min(minR, c.r);
-      minG = std::min(minG, c.g);
-      minB = std::min(minB, c.b);
-      maxR = std::max(maxR, c.r);
-      maxG = std::max(maxG, c.g);
-      maxB = std::max(maxB, c.b);
-    }
+// Every pixel adds |p - avg| >= 0 to the sum, so the sum over the rows seen
+// so far bounds the MAD from below. Over all rows it is the exact value,
+// computed as in compute().
+bool MADMetric::exceeds(const ImageView& image, int x, int y, int width,
+                        int height, double threshold, double& error) {
+  if (threshold <= 0) {
+    error = 0.0;
+    return true;
+  }
+  uint64_t sums[3];
+  long long count = static_cast<long long>(width) * height;
+  channelSums(image, x, y, width, height, sums);
+  uint8_t k[3];
+  double f[3];
+  for (int c = 0; c < 3; c++) {
+    double avg = sums[c] / (double)count;
+    k[c] = static_cast<uint8_t>(avg);
+    f[c] = avg - k[c];
   }
-  double dR = maxR - minR;
-  double dG = maxG - minG;
-  double dB = maxB - minB;
-  return (dR + dG + dB) / 3.0;
+  uint64_t sad[3] = {0, 0, 0}, above[3] = {0, 0, 0};
+  long long seen = 0;
+  auto mad = [&] {
+    double total = 0.0;
+    for (int c = 0; c < 3; c++)
+      total += sad[c] + f[c] * ((double)(seen - above[c]) - (double)above[c]);
+    return total / count;
+  };
+  double bar = threshold * (1 + kMadMargin);
+  bool stopped = visitRowsCoarseFirst(y, height, [&](int i) {
+    for (int c = 0; c < 3; c++)
+      MetricKernels::absDiffRow(image.row(c, i) + x, width, k[c], sad[c],
+                                above[c]);
+    seen += width;
+    return mad() >= bar;
+  });
+  error = mad();
+  return stopped || static_cast<float>(error) >= threshold;
 }
 
-double EntropyMetric::compute(const std::vector<std::vector<Color>>& pixels,
-                              int x, int y, int width, int height) {
-  int count = width * height;
-  std::vector<int> histR(256, 0), histG(256, 0), histB(256, 0);
-  for (int i = y; i < y + height; i++) {
-    for (int j = x; j < x + width; j++) {
-      const Color& c = pixels[i][j];
-      histR[c.r]++;
-      histG[c.g]++;
-      histB[c.b]++;
-    }
+double MaxPixelDifferenceMetric::compute(const ImageView& image, int x, int y,
+                                         int width, int height) {
+  double range = 0.0;
+  for (int c = 0; c < 3; c++) {
+    uint8_t lo = 255, hi = 0;
+    for (int i = y; i < y + height; i++)
+      MetricKernels::minMaxRow(image.row(c, i) + x, width, lo, hi);
+    range += hi - lo;
   }
-  double entropyR = 0.0, entropyG = 0.0, entropyB = 0.0;
-  for (int i = 0; i < 256; i++) {
-    if (histR[i] > 0) {
-      double p = histR[i] / (double)count;
-      entropyR -= p * std::log2(p);
-    }
-    if (histG[i] > 0) {
-      double p = histG[i] / (double)count;
-      entropyG -= p * std::log2(p);
-    }
-    if (histB[i] > 0) {
-      double p = histB[i] / (double)count;
-      entropyB -= p * std::log2(p);
+  return range / 3.0;
+}
+
+// The ranges only grow as rows are added, so the test can stop at the
+// first row that lifts them over the threshold.
+bool MaxPixelDifferenceMetric::exceeds(const ImageView& image, int x, int y,
+                                       int width, int height,
+                                       double threshold, double& error) {
+  uint8_t lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+  auto range = [&] {
+    return (hi[0] - lo[0] + hi[1] - lo[1] + hi[2] - lo[2]) / 3.0;
+  };
+  bool stopped = visitRowsCoarseFirst(y, height, [&](int i) {
+    for (int c = 0; c < 3; c++)
+      MetricKernels::minMaxRow(image.row(c, i) + x, width, lo[c], hi[c]);
+    return static_cast<float>(range()) >= threshold;
+  });
+  error = range();
+  return stopped;
+}
+
+// Blocks of at most this many pixels are counted by sorting their values,
+// which is cheaper than clearing and reading 256-bin histograms.
+const int kSortedBlock = 64;
+
+double EntropyMetric::compute(const ImageView& image, int x, int y, int width,
+                              int height) {
+  long long count = static_cast<long long>(width) * height;
+  double entropy = 0.0;
+  if (count <= kSortedBlock) {
+    uint8_t values[kSortedBlock];
+    uint32_t bins[kSortedBlock];
+    for (int c = 0; c < 3; c++) {
+      int n = 0;
+      for (int i = y; i < y + height; i++) {
+        const uint8_t* row = image.row(c, i);
+        for (int j = x; j < x + width; j++) values[n++] = row[j];
+      }
+      std::sort(values, values + n);
+      int used = 0;
+      for (int i = 0; i < n; i++) {
+        if (i == 0 || values[i] != values[i - 1]) bins[used++] = 0;
+        bins[used - 1]++;
+      }
+      entropy += MetricKernels::entropyOfBins(bins, used, count);
     }
+    return entropy / 3.0;
   }
-  return (entropyR + entropyG + entropyB) / 3.0;
+
+  uint32_t hist[4 * 256];
+  for (int c = 0; c < 3; c++) {
+    std::fill(hist, hist + 4 * 256, 0);
+    for (int i = y; i < y + height; i++)
+      MetricKernels::histogramRow(image.row(c, i) + x, width, hist);
+    for (int v = 0; v < 256; v++)
+      hist[v] += hist[256 + v] + hist[512 + v] + hist[768 + v];
+    entropy += MetricKernels::entropy(hist, count);
+  }
+  return entropy / 3.0;
 }
 
-SSIMetric::SSIMetric(double threshold) : threshold(threshold) {}
+namespace {
 
-double SSIMetric::compute(const std::vector<std::vector<Color>>& pixels, int x,
-                          int y, int width, int height) {
+// SSIM of count values against a constant reconstruction, from the values'
+// sum and sum of squares and the reconstruction, all in units of 1/scale.
+double flatSSIM(long long count, uint64_t sum, unsigned __int128 sumSq,
+                uint64_t reconstruction, double scale) {
   const double C1 = 0.01 * 255 * 0.01 * 255;  // (K1*L)^2
   const double C2 = 0.03 * 255 * 0.03 * 255;  // (K2*L)^2
+  double n = static_cast<double>(count);
+  unsigned __int128 spread = static_cast<unsigned __int128>(count) * sumSq -
+                             static_cast<unsigned __int128>(sum) * sum;
+  double meanX = sum / (scale * n);
+  double meanY = reconstruction / scale;
+  double varX = static_cast<double>(spread) / (n * n * scale * scale);
+  return (2 * meanX * meanY + C1) * C2 /
+         ((meanX * meanX + meanY * meanY + C1) * (varX + C2));
+}
 
-  double mean_original = 0.0;
-  for (int i = y; i < y + height; i++) {
-    for (int j = x; j < x + width; j++) {
-      double intensity = 0.299 * pixels[i][j].r + 0.587 * pixels[i][j].g +
-                         0.114 * pixels[i][j].b;
-      mean_original += intensity;
+}  // namespace
+
+SSIMetric::SSIMetric(bool perChannel) : perChannel(perChannel) {}
+
+// The reconstruction is the truncated average color the leaf is drawn with.
+double SSIMetric::fromSums(long long count, const uint64_t sum[3],
+                           const uint64_t channelSq[3],
+                           unsigned __int128 lumaSq) const {
+  if (count == 0) return 0.0;
+  uint64_t average[3];
+  for (int c = 0; c < 3; c++) average[c] = sum[c] / count;
+  if (perChannel) {
+    double ssim = 0.0;
+    for (int c = 0; c < 3; c++)
+      ssim += flatSSIM(count, sum[c], channelSq[c], average[c], 1.0);
+    return 1.0 - ssim / 3.0;
+  }
+  uint64_t lumaSum = 299 * sum[0] + 587 * sum[1] + 114 * sum[2];
+  uint64_t reconstruction =
+      299 * average[0] + 587 * average[1] + 114 * average[2];
+  return 1.0 - flatSSIM(count, lumaSum, lumaSq, reconstruction, 1000.0);
+}
+
+double SSIMetric::compute(const ImageView& image, int x, int y, int width,
+                          int height) {
+  if (integral && integral->getSquareSums() == squareSums())
+    return compute(integral->query(x, y, width, height));
+  return compute(BlockSummary::of(image.subview(x, y, width, height), false));
+}
+
+// Expects the sums of an integral image built with squareSums().
+double SSIMetric::compute(const BlockSums& sums) const {
+  return fromSums(sums.count, sums.sum, sums.channelSq, sums.lumaSq);
+}
+
+// Summarise every pixel of the view. Histograms are only filled when asked
+// for, since they make a summary 6 KB larger.
+BlockSummary BlockSummary::of(const ImageView& image, bool withHistogram) {
+  BlockSummary summary;
+  int width = image.getWidth(), height = image.getHeight();
+  summary.count = static_cast<long long>(width) * height;
+  uint32_t hist[3][4 * 256];
+  if (withHistogram) std::fill(&hist[0][0], &hist[0][0] + 3 * 4 * 256, 0);
+  for (int i = 0; i < height; i++) {
+    const uint8_t* r = image.row(0, i);
+    const uint8_t* g = image.row(1, i);
+    const uint8_t* b = image.row(2, i);
+    uint64_t rowR = 0, rowG = 0, rowB = 0, rowLuma = 0;
+    uint64_t rowSqR = 0, rowSqG = 0, rowSqB = 0;
+    uint8_t loR = 255, loG = 255, loB = 255, hiR = 0, hiG = 0, hiB = 0;
+    for (int j = 0; j < width; j++) {
+      uint64_t luma = 299 * r[j] + 587 * g[j] + 114 * b[j];
+      rowR += r[j];
+      rowG += g[j];
+      rowB += b[j];
+      rowSqR += r[j] * r[j];
+      rowSqG += g[j] * g[j];
+      rowSqB += b[j] * b[j];
+      rowLuma += luma * luma;
+      loR = std::min(loR, r[j]);
+      loG = std::min(loG, g[j]);
+      loB = std::min(loB, b[j]);
+      hiR = std::max(hiR, r[j]);
+      hiG = std::max(hiG, g[j]);
+      hiB = std::max(hiB, b[j]);
     }
+    summary.sum[0] += rowR;
+    summary.sum[1] += rowG;
+    summary.sum[2] += rowB;
+    summary.sumSq[0] += rowSqR;
+    summary.sumSq[1] += rowSqG;
+    summary.sumSq[2] += rowSqB;
+    summary.lumaSq += rowLuma;
+    summary.lo[0] = std::min(summary.lo[0], loR);
+    summary.lo[1] = std::min(summary.lo[1], loG);
+    summary.lo[2] = std::min(summary.lo[2], loB);
+    summary.hi[0] = std::max(summary.hi[0], hiR);
+    summary.hi[1] = std::max(summary.hi[1], hiG);
+    summary.hi[2] = std::max(summary.hi[2], hiB);
+    if (withHistogram)
+      for (int c = 0; c < 3; c++)
+        MetricKernels::histogramRow(image.row(c, i), width, hist[c]);
+  }
+  if (withHistogram) {
+    summary.histogram.assign(3 * 256, 0);
+    for (int c = 0; c < 3; c++)
+      for (int v = 0; v < 256; v++)
+        summary.histogram[c * 256 + v] = static_cast<uint64_t>(hist[c][v]) +
+                                         hist[c][256 + v] + hist[c][512 + v] +
+                                         hist[c][768 + v];
+  }
+  return summary;
+}
+
+void BlockSummary::add(const BlockSummary& other) {
+  count += other.count;
+  for (int c = 0; c < 3; c++) {
+    sum[c] += other.sum[c];
+    sumSq[c] += other.sumSq[c];
+    lo[c] = std::min(lo[c], other.lo[c]);
+    hi[c] = std::max(hi[c], other.hi[c]);
   }
+  lumaSq += other.lumaSq;
+  if (histogram.empty()) {
+    histogram = other.histogram;
+  } else {
+    for (size_t i = 0; i < other.histogram.size(); i++)
+      histogram[i] += other.histogram[i];
+  }
+}
 
-  int num_pixels = width * height;
-  mean_original /= num_pixels;
+// Truncated like IntegralImage::average.
+Color BlockSummary::average() const {
+  if (count == 0) return Color{0, 0, 0};
+  return Color{static_cast<int>(sum[0] / count),
+               static_cast<int>(sum[1] / count),
+               static_cast<int>(sum[2] / count)};
+}
 
-  double mean_x = mean_original;
-  double mean_y = mean_original;
+double VarianceMetric::compute(const BlockSums& sums) const {
+  return IntegralImage::variance(sums.count, sums.sum, sums.sumSq);
+}
 
-  double var_x = 0.0;
-  for (int i = y; i < y + height; i++) {
-    for (int j = x; j < x + width; j++) {
-      double intensity_x = 0.299 * pixels[i][j].r + 0.587 * pixels[i][j].g +
-                           0.114 * pixels[i][j].b;
-      var_x += (intensity_x - mean_x) * (intensity_x - mean_x);
+double VarianceMetric::compute(const BlockSummary& summary) {
+  return IntegralImage::variance(
+      summary.count, summary.sum,
+      summary.sumSq[0] + summary.sumSq[1] + summary.sumSq[2]);
+}
+
+// The same split of |p - avg| as the scan above, summed over histogram bins.
+double MADMetric::compute(const BlockSummary& summary) {
+  double mad = 0.0;
+  long long count = summary.count;
+  for (int c = 0; c < 3; c++) {
+    const uint64_t* hist = &summary.histogram[c * 256];
+    double avg = summary.sum[c] / (double)count;
+    uint8_t k = static_cast<uint8_t>(avg);
+    double f = avg - k;
+    uint64_t sad = 0, above = 0;
+    for (int v = 0; v < 256; v++) {
+      sad += hist[v] * static_cast<uint64_t>(v > k ? v - k : k - v);
+      if (v > k) above += hist[v];
     }
+    mad += sad + f * ((double)(count - above) - (double)above);
   }
-  double var_y = 0.0;
-  double covar = 0.0;
+  return mad / count;
+}
 
-  var_x /= (num_pixels - 1);
+double MaxPixelDifferenceMetric::compute(const BlockSummary& summary) {
+  double range = 0.0;
+  for (int c = 0; c < 3; c++) range += summary.hi[c] - summary.lo[c];
+  return range / 3.0;
+}
 
-  double ssim =
-      (2 * mean_x * mean_y + C1) * (2 * covar + C2) /
-      ((mean_x * mean_x + mean_y * mean_y + C1) * (var_x + var_y + C2));
+double EntropyMetric::compute(const BlockSummary& summary) {
+  double entropy = 0.0;
+  for (int c = 0; c < 3; c++)
+    entropy += MetricKernels::entropy(&summary.histogram[c * 256],
+                                      summary.count);
+  return entropy / 3.0;
+}
 
-  return 2 * threshold - ssim;
-}
\ No newline at end of file
+double SSIMetric::compute(const BlockSummary& summary) {
+  return fromSums(summary.count, summary.sum, summary.sumSq, summary.lumaSq);
+}
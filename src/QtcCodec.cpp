@@ -0,0 +1,362 @@
+#include "QtcCodec.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+#include <utility>
+
+#include "Quadtree.hpp"
+
+namespace {
+
+const char kMagic[4] = {'Q', 'T', 'C', '1'};
+const int kSymbols = 256;
+const size_t kTableBytes = kSymbols / 2;
+const size_t kHeaderSize = 16 + 2 * kTableBytes;
+
+// Map a byte difference, read as a signed value, to 0, -1, 1, -2, 2, ... so
+// small changes either way get small symbols.
+uint8_t zigzag(uint8_t delta) {
+  return static_cast<uint8_t>((delta << 1) ^ (delta & 0x80 ? 0xff : 0));
+}
+uint8_t unzigzag(uint8_t symbol) {
+  return static_cast<uint8_t>((symbol >> 1) ^ (symbol & 1 ? 0xff : 0));
+}
+
+void writeU32(std::vector<uint8_t>& out, uint32_t value) {
+  for (int i = 0; i < 4; i++) out.push_back((value >> (8 * i)) & 0xff);
+}
+uint32_t readU32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+
+// Huffman code lengths for the given symbol counts. If the tree is deeper
+// than maxLength the counts are halved and the code rebuilt, which flattens
+// it until it fits.
+std::vector<uint8_t> huffmanLengths(std::vector<uint64_t> counts,
+                                    int maxLength) {
+  std::vector<uint8_t> lengths(counts.size(), 0);
+  for (;;) {
+    std::vector<int> used;
+    for (size_t s = 0; s < counts.size(); s++)
+      if (counts[s]) used.push_back(static_cast<int>(s));
+    if (used.empty()) return lengths;
+    if (used.size() == 1) {
+      lengths[used[0]] = 1;
+      return lengths;
+    }
+
+    typedef std::pair<uint64_t, int> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+    std::vector<int> parent(used.size(), -1);
+    for (size_t i = 0; i < used.size(); i++)
+      heap.push(Entry(counts[used[i]], static_cast<int>(i)));
+    while (heap.size() > 1) {
+      Entry a = heap.top();
+      heap.pop();
+      Entry b = heap.top();
+      heap.pop();
+      int node = static_cast<int>(parent.size());
+      parent.push_back(-1);
+      parent[a.second] = parent[b.second] = node;
+      heap.push(Entry(a.first + b.first, node));
+    }
+
+    int deepest = 0;
+    for (size_t i = 0; i < used.size(); i++) {
+      int depth = 0;
+      for (int j = static_cast<int>(i); parent[j] != -1; j = parent[j])
+        depth++;
+      lengths[used[i]] = static_cast<uint8_t>(depth);
+      deepest = std::max(deepest, depth);
+    }
+    if (deepest <= maxLength) return lengths;
+    for (uint64_t& count : counts)
+      if (count) count = (count + 1) / 2;
+  }
+}
+
+// Canonical codes: shorter codes first, ties broken by symbol.
+std::vector<uint32_t> canonicalCodes(const std::vector<uint8_t>& lengths) {
+  std::vector<uint32_t> codes(lengths.size(), 0);
+  uint32_t code = 0;
+  for (int length = 1; length <= QtcCodec::kMaxCodeLength; length++) {
+    for (size_t s = 0; s < lengths.size(); s++)
+      if (lengths[s] == length) codes[s] = code++;
+    code <<= 1;
+  }
+  return codes;
+}
+
+// Table indexed by the next kMaxCodeLength bits: symbol << 4 | code length,
+// or 0 for bit patterns that start no code.
+std::vector<uint16_t> decodeTable(const std::vector<uint8_t>& lengths) {
+  const int maxLength = QtcCodec::kMaxCodeLength;
+  uint32_t kraft = 0;
+  for (uint8_t length : lengths) {
+    if (length > maxLength)
+      throw std::runtime_error("Invalid code length in .qtc data");
+    if (length) kraft += 1u << (maxLength - length);
+  }
+  if (kraft > (1u << maxLength))
+    throw std::runtime_error("Invalid code lengths in .qtc data");
+
+  std::vector<uint16_t> table(size_t(1) << maxLength, 0);
+  std::vector<uint32_t> codes = canonicalCodes(lengths);
+  for (size_t s = 0; s < lengths.size(); s++) {
+    if (!lengths[s]) continue;
+    uint32_t first = codes[s] << (maxLength - lengths[s]);
+    uint32_t last = (codes[s] + 1) << (maxLength - lengths[s]);
+    for (uint32_t i = first; i < last; i++)
+      table[i] = static_cast<uint16_t>((s << 4) | lengths[s]);
+  }
+  return table;
+}
+
+class BitReader {
+ private:
+  const uint8_t* data;
+  size_t size, pos;
+  uint64_t buffer;
+  int bits;
+  uint64_t remaining;  // bits of real data not yet consumed
+
+  void refill() {
+    while (bits <= 56) {
+      uint64_t byte = pos < size ? data[pos] : 0;
+      buffer |= byte << (56 - bits);
+      pos++;
+      bits += 8;
+    }
+  }
+  void consume(int count) {
+    if (static_cast<uint64_t>(count) > remaining)
+      throw std::runtime_error("Truncated .qtc data");
+    buffer <<= count;
+    bits -= count;
+    remaining -= count;
+  }
+
+ public:
+  BitReader(const uint8_t* data, size_t size)
+      : data(data), size(size), pos(0), buffer(0), bits(0),
+        remaining(static_cast<uint64_t>(size) * 8) {}
+
+  bool readBit() {
+    if (bits < 1) refill();
+    bool bit = buffer >> 63;
+    consume(1);
+    return bit;
+  }
+  uint8_t readSymbol(const std::vector<uint16_t>& table) {
+    if (bits < QtcCodec::kMaxCodeLength) refill();
+    uint16_t entry = table[buffer >> (64 - QtcCodec::kMaxCodeLength)];
+    if (!entry) throw std::runtime_error("Invalid code in .qtc data");
+    consume(entry & 0xf);
+    return static_cast<uint8_t>(entry >> 4);
+  }
+};
+
+const Color kRootParent(128, 128, 128);
+
+struct NodeSymbols {
+  uint8_t green, red, blue;
+};
+
+// Green is coded as a difference from the parent; red and blue as their own
+// difference minus green's.
+NodeSymbols symbolsOf(const Color& parent, const Color& color) {
+  uint8_t dg = static_cast<uint8_t>(color.g - parent.g);
+  return NodeSymbols{zigzag(dg),
+                     zigzag(static_cast<uint8_t>(color.r - parent.r - dg)),
+                     zigzag(static_cast<uint8_t>(color.b - parent.b - dg))};
+}
+
+// Call visit(parent, node, split) for every visible node of the tree in
+// stream order, where split is -1 for blocks too small to split.
+template <typename Visit>
+void walkTree(const Quadtree& tree, const Color& rootParent, Visit visit) {
+  const NodeArena& nodes = tree.getNodes();
+  int minBlockSize = tree.getMinBlockSize();
+  struct Pending {
+    uint32_t index;
+    Block block;
+    Color parent;
+  };
+  std::vector<Pending> stack = {{0, tree.getRootBlock(), rootParent}};
+  while (!stack.empty()) {
+    Pending pending = stack.back();
+    stack.pop_back();
+    const QuadtreeNode& node = nodes[pending.index];
+    bool split = !node.isLeaf();
+    visit(pending.parent, node,
+          pending.block.canSplit(minBlockSize) ? int(split) : -1);
+    if (!split) continue;
+    for (int i = 3; i >= 0; i--)
+      stack.push_back(Pending{node.firstChild + i, pending.block.child(i),
+                              node.getColor()});
+  }
+}
+
+}  // namespace
+
+std::vector<uint8_t> QtcCodec::encode(const Quadtree& tree) {
+  std::vector<uint8_t> out;
+  encode(tree, out);
+  return out;
+}
+
+void QtcCodec::encode(const Quadtree& tree, std::vector<uint8_t>& out) {
+  QtcSymbolCounts counts;
+  counts.addNode(kRootParent, tree.getRoot().getColor());
+  counts.addDescendants(tree);
+
+  Block root = tree.getRootBlock();
+  QtcHeader header{root.width, root.height, tree.getMinBlockSize()};
+  QtcEncoder encoder(header, counts, out);
+  encoder.writeTree(tree, kRootParent);
+  encoder.finish();
+}
+
+bool QtcCodec::readHeader(const uint8_t* data, size_t size,
+                          QtcHeader& header) {
+  if (size <= kHeaderSize || std::memcmp(data, kMagic, 4) != 0) return false;
+  uint32_t width = readU32(data + 4);
+  uint32_t height = readU32(data + 8);
+  uint32_t minBlockSize = readU32(data + 12);
+  if (width == 0 || height == 0 || minBlockSize == 0 ||
+      minBlockSize > INT_MAX || uint64_t(width) * height > kMaxPixels)
+    return false;
+  header.width = static_cast<int>(width);
+  header.height = static_cast<int>(height);
+  header.minBlockSize = static_cast<int>(minBlockSize);
+  return true;
+}
+
+void QtcCodec::decode(const uint8_t* data, size_t size,
+                      const PixelBuffer& target) {
+  QtcHeader header;
+  if (!readHeader(data, size, header))
+    throw std::runtime_error("Not a .qtc stream");
+  if (target.width < header.width || target.height < header.height)
+    throw std::runtime_error("Output buffer too small for .qtc image");
+
+  std::vector<uint8_t> lengths[2];
+  for (int t = 0; t < 2; t++) {
+    const uint8_t* packed = data + 16 + t * kTableBytes;
+    for (size_t i = 0; i < kTableBytes; i++) {
+      lengths[t].push_back(packed[i] >> 4);
+      lengths[t].push_back(packed[i] & 0xf);
+    }
+  }
+  std::vector<uint16_t> greenTable = decodeTable(lengths[0]);
+  std::vector<uint16_t> chromaTable = decodeTable(lengths[1]);
+  BitReader reader(data + kHeaderSize, size - kHeaderSize);
+
+  struct Pending {
+    Block block;
+    uint8_t r, g, b;
+  };
+  std::vector<Pending> stack = {
+      {Block{0, 0, header.width, header.height, 0}, 128, 128, 128}};
+  while (!stack.empty()) {
+    Pending pending = stack.back();
+    stack.pop_back();
+    uint8_t dg = unzigzag(reader.readSymbol(greenTable));
+    uint8_t dr = unzigzag(reader.readSymbol(chromaTable));
+    uint8_t db = unzigzag(reader.readSymbol(chromaTable));
+    uint8_t g = static_cast<uint8_t>(pending.g + dg);
+    uint8_t r = static_cast<uint8_t>(pending.r + dr + dg);
+    uint8_t b = static_cast<uint8_t>(pending.b + db + dg);
+    const Block& block = pending.block;
+    if (block.canSplit(header.minBlockSize) && reader.readBit()) {
+      for (int i = 3; i >= 0; i--)
+        stack.push_back(Pending{block.child(i), r, g, b});
+    } else {
+      Rasterizer::fillRect(target, block.x, block.y, block.width,
+                           block.height, r, g, b);
+    }
+  }
+}
+
+bool QtcCodec::isQtcPath(const std::string& path) {
+  return path.size() >= 4 && path.compare(path.size() - 4, 4, ".qtc") == 0;
+}
+
+QtcSymbolCounts::QtcSymbolCounts() : green(kSymbols, 0), chroma(kSymbols, 0) {}
+
+void QtcSymbolCounts::addNode(const Color& parent, const Color& color) {
+  NodeSymbols symbols = symbolsOf(parent, color);
+  green[symbols.green]++;
+  chroma[symbols.red]++;
+  chroma[symbols.blue]++;
+}
+
+void QtcSymbolCounts::addDescendants(const Quadtree& tree) {
+  bool root = true;
+  walkTree(tree, kRootParent,
+           [&](const Color& parent, const QuadtreeNode& node, int) {
+             if (!root) addNode(parent, node.getColor());
+             root = false;
+           });
+}
+
+void QtcSymbolCounts::add(const QtcSymbolCounts& other) {
+  for (int s = 0; s < kSymbols; s++) {
+    green[s] += other.green[s];
+    chroma[s] += other.chroma[s];
+  }
+}
+
+QtcEncoder::QtcEncoder(const QtcHeader& header, const QtcSymbolCounts& counts,
+                       std::vector<uint8_t>& out)
+    : greenLengths(huffmanLengths(counts.green, QtcCodec::kMaxCodeLength)),
+      chromaLengths(huffmanLengths(counts.chroma, QtcCodec::kMaxCodeLength)),
+      greenCodes(canonicalCodes(greenLengths)),
+      chromaCodes(canonicalCodes(chromaLengths)),
+      out(out),
+      buffer(0),
+      bits(0) {
+  out.insert(out.end(), kMagic, kMagic + 4);
+  writeU32(out, header.width);
+  writeU32(out, header.height);
+  writeU32(out, header.minBlockSize);
+  for (const std::vector<uint8_t>* lengths : {&greenLengths, &chromaLengths})
+    for (int s = 0; s < kSymbols; s += 2)
+      out.push_back(static_cast<uint8_t>(((*lengths)[s] << 4) |
+                                         (*lengths)[s + 1]));
+}
+
+void QtcEncoder::writeBits(uint32_t value, int count) {
+  buffer = (buffer << count) | value;
+  bits += count;
+  while (bits >= 8) {
+    bits -= 8;
+    out.push_back(static_cast<uint8_t>(buffer >> bits));
+  }
+}
+
+void QtcEncoder::writeNode(const Color& parent, const Color& color,
+                           int split) {
+  NodeSymbols symbols = symbolsOf(parent, color);
+  writeBits(greenCodes[symbols.green], greenLengths[symbols.green]);
+  writeBits(chromaCodes[symbols.red], chromaLengths[symbols.red]);
+  writeBits(chromaCodes[symbols.blue], chromaLengths[symbols.blue]);
+  if (split >= 0) writeBits(split, 1);
+}
+
+void QtcEncoder::writeTree(const Quadtree& tree, const Color& parent) {
+  walkTree(tree, parent,
+           [&](const Color& parent, const QuadtreeNode& node, int split) {
+             writeNode(parent, node.getColor(), split);
+           });
+}
+
+void QtcEncoder::finish() {
+  if (bits > 0) out.push_back(static_cast<uint8_t>(buffer << (8 - bits)));
+  bits = 0;
+}
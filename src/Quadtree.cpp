@@ -1,149 +1,432 @@
 #include "Quadtree.hpp"
 
-// Create an image by coloring each leaf node with its average color.
-FIBITMAP* Quadtree::createImage(int customDepth, bool showLines) {
-  int width = pixelData[0].size();
-  int height = pixelData.size();
+#include <chrono>
+#include <cstdint>
+
+#include "Rasterizer.hpp"
+
+// Create an image by coloring each leaf node with its average color. Nodes at
+// customDepth are painted as leaves, and showLines outlines every block.
+FIBITMAP* Quadtree::createImage(int customDepth, bool showLines,
+                                int threadCount) {
+  int width = pixelData.getWidth();
+  int height = pixelData.getHeight();
 
-  FreeImage_Initialise();
   FIBITMAP* bitmap = FreeImage_Allocate(width, height, 24);
   if (!bitmap) {
     std::cerr << "Error: Cannot allocate bitmap in createImage()." << std::endl;
-    FreeImage_DeInitialise();
     return nullptr;
   }
 
-  // Recursively draw each node from the quadtree into the bitmap.
-  std::function<void(QuadtreeNode*)> drawNode = [&](QuadtreeNode* node) {
-    if (!node) return;
-    if (node->isLeaf || node->depth >= customDepth) {
-      for (int y = node->y; y < node->y + node->height; y++) {
-        for (int x = node->x; x < node->x + node->width; x++) {
-          RGBQUAD col;
-          col.rgbRed = node->color.r;
-          col.rgbGreen = node->color.g;
-          col.rgbBlue = node->color.b;
-          FreeImage_SetPixelColor(bitmap, x, y, &col);
-        }
-      }
-    } else {
-      for (int i = 0; i < 4; i++) {
-        if (node->children[i] != nullptr) {
-          drawNode(node->children[i]);
-        }
-      }
-    }
-  };
-
-  drawNode(root);
-  FreeImage_DeInitialise();
+  RasterOptions options;
+  options.maxDepth = customDepth;
+  options.outline = showLines;
+  options.threadCount = threadCount;
+  options.pool = this->options.pool;
+  Rasterizer::paint(*this, PixelBuffer::fromBitmap(bitmap), options);
   return bitmap;
 }
 
+namespace {
+
+// Below this many pixels, rescanning a block costs less than merging and
+// reading 3 x 256 histogram bins, so the bottom-up engine scores small
+// blocks of the histogram metrics from their pixels.
+const long long kHistogramArea = 1024;
+
+// The best-first engine reads the clock once per this many splits.
+const int kClockInterval = 64;
+
+void countNode(std::vector<LevelCount>& levels, int depth, bool leaf) {
+  if (levels.size() <= static_cast<size_t>(depth))
+    levels.resize(depth + 1, LevelCount{0, 0});
+  levels[depth].nodes++;
+  if (leaf) levels[depth].leaves++;
+}
+
+}  // namespace
+
 // Constructor: Build a quadtree from image data using the given threshold and
-// metric.
-Quadtree::Quadtree(const std::vector<std::vector<Color>>& data,
-                   double threshold, Metric* metric, int minBlockSize)
+// metric. The tree only views the pixels, so the caller keeps them alive. The
+// summed-area tables are built once up front so every node reads its
+// statistics in constant time.
+// The bottom-up engine reads no summed-area tables, so they are left empty.
+// The tables are only read while building and are released (or handed back
+// to the storage) before the constructor returns; given storage, the tree
+// keeps its arena for its lifetime.
+Quadtree::Quadtree(const ImageView& data, double threshold, Metric* metric,
+                   int minBlockSize, const BuildOptions& options,
+                   TreeStorage* storage)
     : pixelData(data),
       threshold(threshold),
       minBlockSize(minBlockSize),
-      metric(metric) {
-  int width = data[0].size();
-  int height = data.size();
-  root = buildQuadtree(0, 0, width, height);
+      metric(metric),
+      options(options),
+      pool(nullptr),
+      storage(storage) {
+  bool bottomUp = options.engine == BuildEngine::BottomUp;
+  if (storage) {
+    std::swap(nodes, storage->nodes);
+    std::swap(integral, storage->integral);
+    nodes.clear();
+  }
+  integral.build(bottomUp ? ImageView() : data, metric->squareSums());
+  if (!bottomUp) metric->setIntegralImage(&integral);
+  nodes.allocate(1);
+  // A smaller root has no block large enough to build in parallel.
+  std::unique_ptr<ThreadPool> workers;
+  if (options.threadCount > 1 &&
+      getRootBlock().area() >= options.parallelCutoff) {
+    pool = options.pool;
+    if (!pool) {
+      workers.reset(new ThreadPool(options.threadCount));
+      pool = workers.get();
+    }
+  }
+  withMetricType(*metric, [&](auto& typed) {
+    if (bottomUp) {
+      buildBottomUp(typed, nodes, 0, getRootBlock());
+      countLevels();
+    } else if (options.engine == BuildEngine::BestFirst) {
+      buildBestFirst(typed);
+      countLevels();
+    } else {
+      std::vector<LevelCount> counted;
+      buildQuadtree(typed, nodes, 0, getRootBlock(), counted);
+      setLevels(counted);
+    }
+  });
+  pool = nullptr;
+  metric->setIntegralImage(nullptr);
+  if (storage)
+    std::swap(integral, storage->integral);
+  else
+    integral = IntegralImage();
 }
 
-// Destructor: Delete the root node, which recursively deletes the whole
-// quadtree.
-Quadtree::~Quadtree() { delete root; }
+// Destructor: The arena owns every node, so the whole quadtree is released
+// in one deallocation, or handed back to the storage it came from.
+Quadtree::~Quadtree() {
+  if (storage) std::swap(nodes, storage->nodes);
+}
 
 // Calculate the average color for the specified block of the image.
-Color Quadtree::calculateAverageColor(
-    const std::vector<std::vector<Color>>& data, int x, int y, int width,
-    int height) {
-  float r = 0, g = 0, b = 0;
-  int count = 0;
-  for (int i = y; i < y + height; i++) {
-    for (int j = x; j < x + width; j++) {
-      r += data[i][j].r;
-      g += data[i][j].g;
-      b += data[i][j].b;
-      count++;
-    }
+Color Quadtree::calculateAverageColor(int x, int y, int width,
+                                      int height) const {
+  return integral.average(x, y, width, height);
+}
+
+// Store the error and average color of a block in its node and return the
+// error. Metrics scored from block sums read both from one summed-area
+// query. Unless exact is set, other metrics only test the block against
+// the threshold and may return a lower bound of an error above it.
+template <typename M>
+float Quadtree::scoreBlock(M& metric, QuadtreeNode& node, const Block& block,
+                           bool exact) {
+  float var;
+  Color color;
+  if constexpr (ReadsBlockSums<M>::value) {
+    BlockSums sums = integral.query(block.x, block.y, block.width,
+                                    block.height);
+    var = metric.compute(sums);
+    color = sums.average();
+  } else {
+    double error;
+    if (exact)
+      error = metric.compute(pixelData, block.x, block.y, block.width,
+                             block.height);
+    else
+      metric.exceeds(pixelData, block.x, block.y, block.width, block.height,
+                     threshold, error);
+    var = error;
+    color = calculateAverageColor(block.x, block.y, block.width,
+                                  block.height);
   }
-  if (count == 0) return Color{0, 0, 0};
-  int avgR = static_cast<int>(r / count);
-  int avgG = static_cast<int>(g / count);
-  int avgB = static_cast<int>(b / count);
-  return Color{avgR, avgG, avgB};
+  QUADTREE_COUNT(counters.metricEvaluations, 1);
+  QUADTREE_COUNT(counters.pixelsTouched, block.area());
+  node.error = var;
+  node.setColor(color);
+  return var;
 }
 
-// Recursively build the quadtree by subdividing blocks that exceed the
-// threshold error.
-QuadtreeNode* Quadtree::buildQuadtree(int x, int y, int width, int height,
-                                      int depth) {
-  float var = metric->compute(pixelData, x, y, width, height);
-  QuadtreeNode* node = new QuadtreeNode(x, y, width, height);
-  node->depth = depth;
-  node->color = calculateAverageColor(pixelData, x, y, width, height);
-  node->isLeaf = true;
-  if (var >= threshold && (width / 2) * (height / 2) >= minBlockSize) {
-    node->isLeaf = false;
-    int halfWidth = width / 2;
-    int halfHeight = height / 2;
-    node->children[0] = buildQuadtree(x, y, halfWidth, halfHeight, depth + 1);
-    node->children[1] = buildQuadtree(x + halfWidth, y, width - halfWidth,
-                                      halfHeight, depth + 1);
-    node->children[2] = buildQuadtree(x, y + halfHeight, halfWidth,
-                                      height - halfHeight, depth + 1);
-    node->children[3] =
-        buildQuadtree(x + halfWidth, y + halfHeight, width - halfWidth,
-                      height - halfHeight, depth + 1);
+// Build the subtree at index by subdividing blocks that exceed the threshold
+// error. Blocks wait on an explicit stack and are taken in the order a
+// recursive build would visit them, so the arena layout is the same and the
+// call stack stays flat however deep the tree gets. Large blocks build three
+// quadrants as pool tasks, each in its own arena so workers never share an
+// allocator, and the fourth on the current thread; the parts are then
+// spliced in quadrant order. Nodes are counted per level into levels.
+template <typename M>
+void Quadtree::buildQuadtree(M& metric, NodeArena& arena, uint32_t index,
+                             const Block& block,
+                             std::vector<LevelCount>& levels) {
+  struct Pending {
+    uint32_t index;
+    Block block;
+  };
+  std::vector<Pending> stack = {{index, block}};
+  while (!stack.empty()) {
+    Pending pending = stack.back();
+    stack.pop_back();
+    const Block& current = pending.block;
+    QuadtreeNode& node = arena[pending.index];
+    float var = scoreBlock(metric, node, current, options.exactErrors);
+    bool split = var >= threshold && current.canSplit(minBlockSize);
+    node.setLeaf(!split);
+    countNode(levels, current.depth, !split);
+    if (!split) continue;
+
+    if (pool && current.area() >= options.parallelCutoff) {
+      NodeArena parts[4];
+      std::vector<LevelCount> partLevels[4];
+      auto buildPart = [&](int i) {
+        parts[i].allocate(1);
+        buildQuadtree(metric, parts[i], 0, current.child(i), partLevels[i]);
+      };
+      TaskGroup group(*pool);
+      for (int i = 0; i < 3; i++) group.run([&, i] { buildPart(i); });
+      buildPart(3);
+      group.wait();
+      uint32_t first = arena.allocate(4);
+      arena[pending.index].firstChild = first;
+      for (int i = 0; i < 4; i++) {
+        arena.splice(first + i, parts[i]);
+        for (size_t depth = 0; depth < partLevels[i].size(); depth++) {
+          if (levels.size() <= depth) levels.resize(depth + 1, {0, 0});
+          levels[depth].nodes += partLevels[i][depth].nodes;
+          levels[depth].leaves += partLevels[i][depth].leaves;
+        }
+      }
+    } else {
+      uint32_t first = arena.allocate(4);
+      arena[pending.index].firstChild = first;
+      for (int i = 3; i >= 0; i--)
+        stack.push_back(Pending{first + i, current.child(i)});
+    }
   }
-  return node;
 }
 
-// Get the maximum depth of the quadtree by recursively exploring each node.
-int Quadtree::getTreeDepth() const {
-  std::function<int(QuadtreeNode*)> depth = [&](QuadtreeNode* node) -> int {
-    if (!node) return 0;
-    if (node->isLeaf) return 1;
-    int maxDepth = 0;
-    for (int i = 0; i < 4; i++) {
-      maxDepth = std::max(maxDepth, depth(node->children[i]));
+// Build the subtree at index from the bottom up and return the summary of
+// its block. Blocks too small to split are summarised from their pixels;
+// every other block merges the summaries of its quadrants and is scored from
+// the result, which gives exactly the error a top-down build computes. The
+// quadrants are built first, in the order a top-down build would allocate
+// them, and are dropped again from the end of the arena if the block turns
+// out not to split, so the layout matches the top-down tree. Blocks of at
+// least parallelCutoff pixels build their quadrants as pool tasks.
+template <typename M>
+BlockSummary Quadtree::buildBottomUp(M& metric, NodeArena& arena,
+                                     uint32_t index, const Block& block) {
+  bool histograms = metric.needsHistogram();
+  auto view = [&](const Block& b) {
+    return pixelData.subview(b.x, b.y, b.width, b.height);
+  };
+
+  // Score a block whose summary is complete, store it at index and return
+  // whether it splits. If the block's quadrants are too small to carry
+  // histograms, it is the first block that needs one.
+  auto score = [&](uint32_t index, const Block& b, BlockSummary& summary) {
+    bool divisible = b.canSplit(minBlockSize);
+    bool histogram = histograms && b.area() >= kHistogramArea;
+    if (divisible && histogram && b.child(0).area() < kHistogramArea) {
+      summary = BlockSummary::of(view(b), true);
+      QUADTREE_COUNT(counters.pixelsTouched, b.area());
     }
-    return 1 + maxDepth;
+    float var = histograms && !histogram
+                    ? metric.compute(pixelData, b.x, b.y, b.width, b.height)
+                    : metric.compute(summary);
+    QUADTREE_COUNT(counters.metricEvaluations, 1);
+    bool split = var >= threshold && divisible;
+    QuadtreeNode& node = arena[index];
+    node.error = var;
+    node.setColor(summary.average());
+    node.setLeaf(!split);
+    return split;
   };
-  return depth(root);
-}
 
-// Count the total number of nodes in the quadtree (internal + leaf nodes).
-int Quadtree::getNodeCount() const {
-  std::function<int(QuadtreeNode*)> countNodes =
-      [&](QuadtreeNode* node) -> int {
-    if (!node) return 0;
-    int count = 1;
-    if (!node->isLeaf) {
-      for (int i = 0; i < 4; i++) {
-        count += countNodes(node->children[i]);
+  struct Frame {
+    uint32_t index;
+    Block block;
+    uint32_t first;  // the four quadrants
+    int next;        // next quadrant to build
+    BlockSummary summary;
+  };
+  std::vector<Frame> stack;
+
+  // Blocks too small to split, and blocks built in parallel, are finished at
+  // once and return true. Others wait on the stack for their quadrants.
+  auto begin = [&](uint32_t index, const Block& b, BlockSummary& summary) {
+    if (!b.canSplit(minBlockSize)) {
+      summary = BlockSummary::of(view(b), histograms &&
+                                              b.area() >= kHistogramArea);
+      QUADTREE_COUNT(counters.pixelsTouched, b.area());
+      score(index, b, summary);
+      return true;
+    }
+    if (pool && b.area() >= options.parallelCutoff) {
+      NodeArena parts[4];
+      BlockSummary partSummaries[4];
+      auto buildPart = [&](int i) {
+        parts[i].allocate(1);
+        partSummaries[i] = buildBottomUp(metric, parts[i], 0, b.child(i));
+      };
+      TaskGroup group(*pool);
+      for (int i = 0; i < 3; i++) group.run([&, i] { buildPart(i); });
+      buildPart(3);
+      group.wait();
+      for (int i = 0; i < 4; i++) summary.add(partSummaries[i]);
+      if (score(index, b, summary)) {
+        uint32_t first = arena.allocate(4);
+        arena[index].firstChild = first;
+        for (int i = 0; i < 4; i++) arena.splice(first + i, parts[i]);
       }
+      return true;
     }
-    return count;
+    uint32_t first = arena.allocate(4);
+    arena[index].firstChild = first;
+    stack.push_back(Frame{index, b, first, 0, BlockSummary()});
+    return false;
   };
-  return countNodes(root);
-}
 
-// Count the number of leaf nodes in the quadtree.
-int Quadtree::getLeafCount() const {
-  std::function<int(QuadtreeNode*)> countLeaves =
-      [&](QuadtreeNode* node) -> int {
-    if (!node) return 0;
-    if (node->isLeaf) return 1;
-    int count = 0;
-    for (int i = 0; i < 4; i++) {
-      count += countLeaves(node->children[i]);
+  BlockSummary result;
+  if (begin(index, block, result)) return result;
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    if (frame.next < 4) {
+      int i = frame.next++;
+      BlockSummary quadrant;
+      if (begin(frame.first + i, frame.block.child(i), quadrant))
+        frame.summary.add(quadrant);
+      continue;
+    }
+
+    if (!score(frame.index, frame.block, frame.summary)) {
+      arena[frame.index].firstChild = 0;
+      arena.truncate(frame.first);
     }
-    return count;
+    BlockSummary summary = std::move(frame.summary);
+    stack.pop_back();
+    if (stack.empty())
+      result = std::move(summary);
+    else
+      stack.back().summary.add(summary);
+  }
+  return result;
+}
+
+// Build the whole tree best first. Every leaf that could split waits in a
+// max-heap keyed on its error times its area, the share of the image's
+// total error it would remove at most, and the top leaf is split and its
+// quadrants scored until a budget runs out or no leaf is left at or above
+// the threshold. A split is never undone, so the tree is complete after
+// every step and stopping at a budget keeps the best tree reached so far.
+// Equal keys split the leaf allocated first, which keeps the tree
+// deterministic. Blocks are always scored exactly, since the key needs the
+// error itself. Children are allocated as leaves are split, so the arena
+// is in split order rather than depth-first order.
+template <typename M>
+void Quadtree::buildBestFirst(M& metric) {
+  struct Candidate {
+    double priority;
+    uint32_t index;
+    Block block;
+  };
+  auto lower = [](const Candidate& a, const Candidate& b) {
+    return a.priority < b.priority ||
+           (a.priority == b.priority && a.index > b.index);
+  };
+  std::vector<Candidate> heap;
+  auto consider = [&](uint32_t index, const Block& block) {
+    float var = scoreBlock(metric, nodes[index], block, true);
+    nodes[index].setLeaf(true);
+    if (!(var >= threshold && block.canSplit(minBlockSize))) return;
+    heap.push_back(Candidate{static_cast<double>(var) * block.area(), index,
+                             block});
+    std::push_heap(heap.begin(), heap.end(), lower);
   };
-  return countLeaves(root);
+
+  // The byte budget is reserved up front: growing the arena by doubling
+  // would leave its capacity, which is what it holds, well past the budget.
+  // Every leaf covers at least minBlockSize pixels, so a tree has at most
+  // 4/3 of area / minBlockSize nodes and a loose budget reserves no more.
+  auto start = std::chrono::steady_clock::now();
+  size_t maxNodes = SIZE_MAX;
+  if (options.maxBytes > 0) {
+    maxNodes = options.maxBytes / sizeof(QuadtreeNode);
+    long long fullTree = getRootBlock().area() / minBlockSize * 4 / 3 + 1;
+    nodes.reserve(std::min(maxNodes, static_cast<size_t>(fullTree)));
+  }
+  long long leaves = 1;
+  consider(0, getRootBlock());
+  for (long long splits = 0; !heap.empty(); splits++) {
+    if (options.maxLeaves > 0 && leaves + 3 > options.maxLeaves) break;
+    if (nodes.size() + 4 > maxNodes) break;
+    if (options.maxSeconds > 0 && splits % kClockInterval == 0) {
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      if (elapsed.count() >= options.maxSeconds) break;
+    }
+    std::pop_heap(heap.begin(), heap.end(), lower);
+    Candidate top = heap.back();
+    heap.pop_back();
+    uint32_t first = nodes.allocate(4);
+    nodes[top.index].firstChild = first;
+    nodes[top.index].setLeaf(false);
+    for (int i = 0; i < 4; i++) consider(first + i, top.block.child(i));
+    leaves += 3;
+  }
+}
+
+// Keep the per-level counts of the visible tree and their totals, which the
+// statistics queries return without walking the tree.
+void Quadtree::setLevels(const std::vector<LevelCount>& counted) {
+  levels = counted;
+  nodeCount = leafCount = 0;
+  for (const LevelCount& level : levels) {
+    nodeCount += level.nodes;
+    leafCount += level.leaves;
+  }
+}
+
+// Re-apply a threshold to a tree that was built with a lower one. Nodes keep
+// their children and cached errors, so the tree can be pruned again with any
+// threshold without recomputing a single metric. The tree must have been
+// built with exact errors.
+void Quadtree::prune(double threshold) {
+  this->threshold = threshold;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    QuadtreeNode& node = nodes[i];
+    if (node.hasChildren()) node.setLeaf(!(node.error >= threshold));
+  }
+  countLevels();
+}
+
+// Count the visible tree level by level.
+void Quadtree::countLevels() {
+  std::vector<LevelCount> counted;
+  std::vector<std::pair<uint32_t, int>> stack = {{0, 0}};
+  while (!stack.empty()) {
+    uint32_t index = stack.back().first;
+    int depth = stack.back().second;
+    stack.pop_back();
+    const QuadtreeNode& node = nodes[index];
+    countNode(counted, depth, node.isLeaf());
+    if (node.isLeaf()) continue;
+    for (int i = 0; i < 4; i++)
+      stack.push_back({node.firstChild + i, depth + 1});
+  }
+  setLevels(counted);
+}
+
+// Collect the sorted, distinct errors of every node that has children. These
+// are the only thresholds at which the pruned tree changes, as long as the
+// tree was built with exact errors.
+std::vector<float> Quadtree::getSplitErrors() const {
+  std::vector<float> errors;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (nodes[i].hasChildren()) errors.push_back(nodes[i].error);
+  }
+  std::sort(errors.begin(), errors.end());
+  errors.erase(std::unique(errors.begin(), errors.end()), errors.end());
+  return errors;
 }
@@ -1,17 +1,10 @@
 #include "QuadtreeNode.hpp"
 
-QuadtreeNode::QuadtreeNode(int _x, int _y, int _width, int _height)
-    : x(_x), y(_y), width(_width), height(_height), isLeaf(true) {
-  for (int i = 0; i < 4; i++) {
-    children[i] = nullptr;
-  }
-}
-
-QuadtreeNode::~QuadtreeNode() {
-  for (int i = 0; i < 4; i++) {
-    if (children[i]) {
-      delete children[i];
-      children[i] = nullptr;
-    }
-  }
+Block Block::child(int i) const {
+  int halfWidth = width / 2;
+  int halfHeight = height / 2;
+  bool right = i & 1, bottom = i & 2;
+  return Block{right ? x + halfWidth : x, bottom ? y + halfHeight : y,
+               right ? width - halfWidth : halfWidth,
+               bottom ? height - halfHeight : halfHeight, depth + 1};
 }
@@ -0,0 +1,61 @@
+#include "QuadtreeQuery.hpp"
+
+Color QuadtreeQuery::colorAt(int x, int y, const DetailLevel& level) const {
+  Block block = tree.getRootBlock();
+  if (x < 0 || y < 0 || x >= block.width || y >= block.height)
+    return Color{0, 0, 0};
+  const NodeArena& nodes = tree.getNodes();
+  uint32_t index = 0;
+  while (!level.stopsAt(nodes[index], block.depth)) {
+    int i = (x >= block.x + block.width / 2 ? 1 : 0) |
+            (y >= block.y + block.height / 2 ? 2 : 0);
+    index = nodes[index].firstChild + i;
+    block = block.child(i);
+  }
+  return nodes[index].getColor();
+}
+
+// Block edges are mapped to output pixels by rounding down. Neighbouring
+// blocks share their edges, so the mapped blocks tile the target exactly;
+// a block that maps to no whole pixel is skipped with its subtree.
+void QuadtreeQuery::render(const PixelBuffer& target,
+                           const DetailLevel& level) const {
+  Block root = tree.getRootBlock();
+  if (root.width == 0 || root.height == 0) return;
+  auto mapX = [&](int x) {
+    return static_cast<int>(static_cast<long long>(x) * target.width /
+                            root.width);
+  };
+  auto mapY = [&](int y) {
+    return static_cast<int>(static_cast<long long>(y) * target.height /
+                            root.height);
+  };
+
+  const NodeArena& nodes = tree.getNodes();
+  std::vector<std::pair<uint32_t, Block>> stack;
+  stack.emplace_back(0, root);
+  while (!stack.empty()) {
+    uint32_t index = stack.back().first;
+    Block block = stack.back().second;
+    stack.pop_back();
+    int x0 = mapX(block.x), x1 = mapX(block.x + block.width);
+    int y0 = mapY(block.y), y1 = mapY(block.y + block.height);
+    if (x0 == x1 || y0 == y1) continue;
+    const QuadtreeNode& node = nodes[index];
+    if (x1 - x0 == 1 && y1 - y0 == 1) {
+      uint8_t* pixel = target.pixel(x0, y0);
+      pixel[FI_RGBA_RED] = node.r;
+      pixel[FI_RGBA_GREEN] = node.g;
+      pixel[FI_RGBA_BLUE] = node.b;
+      if (target.bytesPerPixel == 4) pixel[FI_RGBA_ALPHA] = 255;
+      continue;
+    }
+    if (level.stopsAt(node, block.depth)) {
+      Rasterizer::fillRect(target, x0, y0, x1 - x0, y1 - y0, node.r, node.g,
+                           node.b);
+      continue;
+    }
+    for (int i = 3; i >= 0; i--)
+      stack.emplace_back(node.firstChild + i, block.child(i));
+  }
+}
@@ -0,0 +1,131 @@
+#include "Rasterizer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Quadtree.hpp"
+#include "ThreadPool.hpp"
+
+namespace {
+
+// Images smaller than this are painted on the calling thread alone.
+const long long kParallelArea = 512 * 512;
+
+// Fill count pixels of one row with the same value by repeatedly doubling
+// the initialised prefix.
+void fillSpan(uint8_t* row, int count, int bytesPerPixel,
+              const uint8_t* value) {
+  size_t total = static_cast<size_t>(count) * bytesPerPixel;
+  if (total == 0) return;
+  std::memcpy(row, value, bytesPerPixel);
+  size_t filled = bytesPerPixel;
+  while (filled < total) {
+    size_t chunk = std::min(filled, total - filled);
+    std::memcpy(row + filled, row, chunk);
+    filled += chunk;
+  }
+}
+
+}  // namespace
+
+PixelBuffer PixelBuffer::fromBitmap(FIBITMAP* bitmap) {
+  return PixelBuffer{FreeImage_GetBits(bitmap), FreeImage_GetPitch(bitmap),
+                     static_cast<int>(FreeImage_GetWidth(bitmap)),
+                     static_cast<int>(FreeImage_GetHeight(bitmap)),
+                     static_cast<int>(FreeImage_GetBPP(bitmap) / 8)};
+}
+
+void Rasterizer::fillRect(const PixelBuffer& target, int x, int y, int width,
+                          int height, uint8_t r, uint8_t g, uint8_t b) {
+  int x0 = std::max(x, 0), y0 = std::max(y, 0);
+  int x1 = std::min(x + width, target.width);
+  int y1 = std::min(y + height, target.height);
+  if (x0 >= x1 || y0 >= y1) return;
+  uint8_t value[4] = {0, 0, 0, 255};
+  value[FI_RGBA_RED] = r;
+  value[FI_RGBA_GREEN] = g;
+  value[FI_RGBA_BLUE] = b;
+  uint8_t* first = target.pixel(x0, y0);
+  fillSpan(first, x1 - x0, target.bytesPerPixel, value);
+  size_t span = static_cast<size_t>(x1 - x0) * target.bytesPerPixel;
+  for (int row = y0 + 1; row < y1; row++)
+    std::memcpy(target.pixel(x0, row), first, span);
+}
+
+void Rasterizer::outlineRect(const PixelBuffer& target, int x, int y,
+                             int width, int height) {
+  fillRect(target, x, y, width, 1, 0, 0, 0);
+  fillRect(target, x, y + height - 1, width, 1, 0, 0, 0);
+  fillRect(target, x, y, 1, height, 0, 0, 0);
+  fillRect(target, x + width - 1, y, 1, height, 0, 0, 0);
+}
+
+// Walk the subtree at index with an explicit stack and paint every node
+// that is a leaf or sits at the depth cutoff.
+void Rasterizer::paintSubtree(const NodeArena& nodes, uint32_t root,
+                              const Block& rootBlock,
+                              const PixelBuffer& target,
+                              const RasterOptions& options) {
+  std::vector<std::pair<uint32_t, Block>> stack;
+  stack.emplace_back(root, rootBlock);
+  while (!stack.empty()) {
+    uint32_t index = stack.back().first;
+    Block block = stack.back().second;
+    stack.pop_back();
+    const QuadtreeNode& node = nodes[index];
+    if (node.isLeaf() || block.depth >= options.maxDepth) {
+      fillRect(target, block.x, block.y, block.width, block.height, node.r,
+               node.g, node.b);
+      if (options.outline)
+        outlineRect(target, block.x, block.y, block.width, block.height);
+      continue;
+    }
+    for (int i = 3; i >= 0; i--)
+      stack.emplace_back(node.firstChild + i, block.child(i));
+  }
+}
+
+// The tree is expanded a level at a time until there are a few subtrees per
+// thread, which then become the pool's tasks.
+void Rasterizer::paint(const Quadtree& tree, const PixelBuffer& target,
+                       const RasterOptions& options) {
+  const NodeArena& nodes = tree.getNodes();
+  Block root = tree.getRootBlock();
+  if (options.threadCount <= 1 || root.area() < kParallelArea) {
+    paintSubtree(nodes, 0, root, target, options);
+    return;
+  }
+
+  size_t wanted = 4 * static_cast<size_t>(options.threadCount);
+  std::vector<std::pair<uint32_t, Block>> parts, level = {{0, root}}, next;
+  while (!level.empty() && parts.size() + level.size() < wanted) {
+    for (const auto& entry : level) {
+      const QuadtreeNode& node = nodes[entry.first];
+      if (node.isLeaf() || entry.second.depth >= options.maxDepth) {
+        parts.push_back(entry);
+        continue;
+      }
+      for (int i = 0; i < 4; i++)
+        next.emplace_back(node.firstChild + i, entry.second.child(i));
+    }
+    level.swap(next);
+    next.clear();
+  }
+  parts.insert(parts.end(), level.begin(), level.end());
+
+  std::unique_ptr<ThreadPool> workers;
+  ThreadPool* pool = options.pool;
+  if (!pool) {
+    workers.reset(new ThreadPool(options.threadCount));
+    pool = workers.get();
+  }
+  TaskGroup group(*pool);
+  for (const auto& part : parts)
+    group.run([&, part] {
+      paintSubtree(nodes, part.first, part.second, target, options);
+    });
+  group.wait();
+}
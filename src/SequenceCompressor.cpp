@@ -0,0 +1,196 @@
+#include "SequenceCompressor.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "ImageCompressor.hpp"
+
+namespace {
+
+bool sameColor(const Color& a, const Color& b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+}  // namespace
+
+SequenceCompressor::SequenceCompressor(int errorMethod, double threshold,
+                                       int minBlockSize, int tileSize,
+                                       const BuildOptions& options)
+    : threshold(threshold),
+      minBlockSize(minBlockSize),
+      tileSize(tileSize),
+      buildOptions(options),
+      metric(createMetric(errorMethod)),
+      bitmap(nullptr),
+      frameCount(0) {}
+
+SequenceCompressor::~SequenceCompressor() {
+  if (bitmap) FreeImage_Unload(bitmap);
+}
+
+// Blocks that fit in a tile, and blocks too small to split, are built as a
+// whole; everything above them is scored from its quadrants.
+bool SequenceCompressor::isTile(const Block& block) const {
+  return (block.width <= tileSize && block.height <= tileSize) ||
+         !block.canSplit(minBlockSize);
+}
+
+// Lay out the slots of the block and everything below it in preorder.
+int SequenceCompressor::addSlot(const Block& block) {
+  int index = static_cast<int>(slots.size());
+  slots.emplace_back();
+  slots[index].block = block;
+  slots[index].split = false;
+  slots[index].dirty = true;
+  slots[index].paintedSplit = false;
+  for (int i = 0; i < 4; i++) slots[index].children[i] = -1;
+  if (isTile(block)) return index;
+  for (int i = 0; i < 4; i++) {
+    int child = addSlot(block.child(i));
+    slots[index].children[i] = child;
+  }
+  return index;
+}
+
+bool SequenceCompressor::tileChanged(const Slot& slot,
+                                     const Image& next) const {
+  const Block& block = slot.block;
+  for (int c = 0; c < 3; c++)
+    for (int y = block.y; y < block.y + block.height; y++)
+      if (std::memcmp(frame.row(c, y) + block.x, next.row(c, y) + block.x,
+                      block.width) != 0)
+        return true;
+  return false;
+}
+
+void SequenceCompressor::copyTile(const Slot& slot, const Image& next) {
+  const Block& block = slot.block;
+  for (int c = 0; c < 3; c++)
+    for (int y = block.y; y < block.y + block.height; y++)
+      std::memcpy(frame.row(c, y) + block.x, next.row(c, y) + block.x,
+                  block.width);
+}
+
+// Repaint what changed below the slot and return the number of pixels
+// painted. force repaints everything visible, for blocks that were hidden
+// under a leaf in the last frame. A tile's tree is only built here, so
+// tiles hidden under a leaf cost no more than their summary.
+long long SequenceCompressor::paint(int index, bool force,
+                                    const PixelBuffer& target) {
+  Slot& slot = slots[index];
+  const Block& block = slot.block;
+  long long painted = 0;
+  if (slot.children[0] < 0) {
+    if (force || slot.dirty) {
+      if (!slot.tree)
+        slot.tree.reset(new Quadtree(
+            frame.view().subview(block.x, block.y, block.width, block.height),
+            threshold, metric.get(), minBlockSize, buildOptions));
+      PixelBuffer tile{target.pixel(block.x, block.y), target.pitch,
+                       block.width, block.height, target.bytesPerPixel};
+      Rasterizer::paint(*slot.tree, tile);
+      painted = block.area();
+    }
+  } else if (!slot.split) {
+    if (force || slot.paintedSplit ||
+        !sameColor(slot.color, slot.paintedColor)) {
+      Rasterizer::fillRect(target, block.x, block.y, block.width,
+                           block.height, slot.color.r, slot.color.g,
+                           slot.color.b);
+      painted = block.area();
+    }
+  } else if (force || slot.dirty || !slot.paintedSplit) {
+    for (int i = 0; i < 4; i++)
+      painted += paint(slot.children[i], force || !slot.paintedSplit, target);
+  }
+  slot.paintedColor = slot.color;
+  slot.paintedSplit = slot.split;
+  slot.dirty = false;
+  return painted;
+}
+
+ByteCounts SequenceCompressor::compress(const std::string& inputPath,
+                                        const std::string& outputPath,
+                                        RunStats& stats) {
+  ByteCounts bytes;
+  Image next;
+  {
+    ScopedPhase phase(stats, "decode");
+    bytes.input = loadImage(inputPath, next);
+  }
+  bool first = frameCount == 0;
+  if (first) {
+    frame = Image(next.getWidth(), next.getHeight());
+    addSlot(Block{0, 0, next.getWidth(), next.getHeight(), 0});
+    bitmap = FreeImage_Allocate(next.getWidth(), next.getHeight(), 24);
+    if (!bitmap) throw std::runtime_error("Cannot allocate bitmap");
+  } else if (next.getWidth() != frame.getWidth() ||
+             next.getHeight() != frame.getHeight()) {
+    throw std::runtime_error(inputPath + " is not the size of the first frame");
+  }
+
+  long long dirtyTiles = 0, tiles = 0;
+  {
+    ScopedPhase phase(stats, "diff");
+    for (Slot& slot : slots) {
+      if (slot.children[0] >= 0) continue;
+      tiles++;
+      slot.dirty = first || tileChanged(slot, next);
+      if (!slot.dirty) continue;
+      dirtyTiles++;
+      copyTile(slot, next);
+    }
+  }
+  {
+    ScopedPhase phase(stats, "build");
+    bool histogram = metric->needsHistogram();
+    // Tiles come after their parents in preorder, so walking the slots
+    // backwards summarises every tile before the blocks above it.
+    for (size_t i = slots.size(); i-- > 0;) {
+      Slot& slot = slots[i];
+      if (slot.children[0] < 0) {
+        if (!slot.dirty) continue;
+        const Block& block = slot.block;
+        slot.summary = BlockSummary::of(
+            frame.view().subview(block.x, block.y, block.width, block.height),
+            histogram);
+        slot.tree.reset();
+      } else {
+        slot.dirty = false;
+        for (int child : slot.children) slot.dirty |= slots[child].dirty;
+        if (!slot.dirty) continue;
+        slot.summary = BlockSummary();
+        for (int child : slot.children) slot.summary.add(slots[child].summary);
+      }
+      slot.color = slot.summary.average();
+      // Compared as a float, like the error a full build stores.
+      float error = metric->compute(slot.summary);
+      slot.split = error >= threshold && slot.block.canSplit(minBlockSize);
+    }
+  }
+
+  long long painted;
+  {
+    ScopedPhase phase(stats, "paint");
+    painted = paint(0, first, PixelBuffer::fromBitmap(bitmap));
+  }
+  frameCount++;
+  {
+    ScopedPhase phase(stats, "encode");
+    encoded.clear();
+    encodeJpeg(bitmap, encoded);
+  }
+  {
+    ScopedPhase phase(stats, "write");
+    writeFile(encoded, outputPath);
+  }
+  bytes.output = static_cast<long long>(encoded.size());
+
+  stats.set("width", frame.getWidth());
+  stats.set("height", frame.getHeight());
+  stats.set("frame", static_cast<double>(frameCount - 1));
+  stats.set("tiles", static_cast<double>(tiles));
+  stats.set("dirty_tiles", static_cast<double>(dirtyTiles));
+  stats.set("painted_pixels", static_cast<double>(painted));
+  return bytes;
+}
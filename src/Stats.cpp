@@ -0,0 +1,108 @@
+#include "Stats.hpp"
+
+#include <sys/resource.h>
+
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+#include "Quadtree.hpp"
+
+namespace {
+
+std::string quote(const std::string& text) {
+  std::string out = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += c;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out += escaped;
+    } else {
+      out += c;
+    }
+  }
+  return out + "\"";
+}
+
+// JSON has no infinity or NaN, so those are written as null. A target
+// search that splits nothing picks an infinite threshold.
+std::string number(double value) {
+  if (!std::isfinite(value)) return "null";
+  char buffer[32];
+  snprintf(buffer, sizeof(buffer), "%.9g", value);
+  return buffer;
+}
+
+}  // namespace
+
+bool RunStats::countersEnabled() {
+#ifdef QUADTREE_STATS
+  return true;
+#else
+  return false;
+#endif
+}
+
+long RunStats::peakRssKb() {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+  return usage.ru_maxrss;  // kilobytes on Linux
+}
+
+void RunStats::set(const std::string& key, const std::string& value) {
+  fields.emplace_back(key, quote(value));
+}
+
+void RunStats::set(const std::string& key, double value) {
+  fields.emplace_back(key, number(value));
+}
+
+void RunStats::addPhase(const std::string& name, double seconds) {
+  phases.push_back(Phase{name, seconds, recordPeakRss ? peakRssKb() : -1});
+}
+
+void RunStats::addTree(const Quadtree& tree) {
+  const std::vector<LevelCount>& levels = tree.getLevelCounts();
+  std::ostringstream perLevel;
+  for (size_t depth = 0; depth < levels.size(); depth++) {
+    perLevel << (depth ? ", " : "") << "{\"depth\": " << depth
+             << ", \"nodes\": " << levels[depth].nodes
+             << ", \"leaves\": " << levels[depth].leaves << "}";
+  }
+  std::ostringstream json;
+  json << "{\"depth\": " << tree.getTreeDepth()
+       << ", \"nodes\": " << tree.getNodeCount()
+       << ", \"leaves\": " << tree.getLeafCount()
+       << ", \"arena_bytes\": " << tree.getNodes().bytes()
+       << ", \"levels\": [" << perLevel.str() << "]}";
+  fields.emplace_back("tree", json.str());
+
+  const BuildCounters& counters = tree.getBuildCounters();
+  std::ostringstream counts;
+  counts << "{\"enabled\": " << (countersEnabled() ? "true" : "false");
+  if (countersEnabled())
+    counts << ", \"metric_evaluations\": " << counters.metricEvaluations
+           << ", \"pixels_touched\": " << counters.pixelsTouched;
+  counts << "}";
+  fields.emplace_back("counters", counts.str());
+}
+
+std::string RunStats::toJson() const {
+  std::ostringstream json;
+  json << "{";
+  for (const auto& field : fields)
+    json << quote(field.first) << ": " << field.second << ", ";
+  json << "\"phases\": [";
+  for (size_t i = 0; i < phases.size(); i++) {
+    json << (i ? ", " : "") << "{\"name\": " << quote(phases[i].name)
+         << ", \"seconds\": " << number(phases[i].seconds);
+    if (recordPeakRss)
+      json << ", \"process_peak_rss_kb\": " << phases[i].peakRssKb;
+    json << "}";
+  }
+  json << "]}";
+  return json.str();
+}
@@ -0,0 +1,152 @@
+#include "ThreadPool.hpp"
+
+namespace {
+// Identifies the pool and slot of the current worker thread.
+thread_local const ThreadPool* workerPool = nullptr;
+thread_local int workerIndex = -1;
+}  // namespace
+
+ThreadPool::ThreadPool(int threadCount)
+    : waiting(0), queued(0), stopping(false) {
+  if (threadCount < 1) threadCount = 1;
+  for (int i = 0; i <= threadCount; i++)
+    queues.push_back(std::make_unique<WorkQueue>());
+  for (int i = 0; i < threadCount; i++)
+    workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto& worker : workers) worker.join();
+}
+
+int ThreadPool::currentWorker() const {
+  return workerPool == this ? workerIndex : -1;
+}
+
+// Push to the caller's own deque when it is a worker, otherwise to the
+// injection queue, then wake one sleeping worker and any waiting thread that
+// could help.
+void ThreadPool::submit(Task task) {
+  int self = currentWorker();
+  WorkQueue& queue = *queues[self >= 0 ? self : size()];
+  {
+    std::lock_guard<std::mutex> guard(queue.lock);
+    queue.tasks.push_back(std::move(task));
+  }
+  queued.fetch_add(1);
+  bool helpers;
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    helpers = waiting > 0;
+  }
+  wake.notify_one();
+  if (helpers) progress.notify_all();
+}
+
+// Take the newest task from our own deque, else the oldest task from the
+// injection queue or another worker.
+bool ThreadPool::popTask(int self, Task& task) {
+  if (queued.load() == 0) return false;
+  if (self >= 0) {
+    WorkQueue& own = *queues[self];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      queued.fetch_sub(1);
+      return true;
+    }
+  }
+  int count = static_cast<int>(queues.size());
+  int start = self >= 0 ? self + 1 : 0;
+  for (int k = 0; k < count; k++) {
+    int victim = (start + k) % count;
+    if (victim == self) continue;
+    WorkQueue& queue = *queues[victim];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      queued.fetch_sub(1);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ThreadPool::runPendingTask() {
+  Task task;
+  if (!popTask(currentWorker(), task)) return false;
+  task();
+  return true;
+}
+
+void ThreadPool::waitUntil(const std::function<bool()>& done) {
+  while (!done()) {
+    if (runPendingTask()) continue;
+    std::unique_lock<std::mutex> guard(sleepLock);
+    waiting++;
+    progress.wait(guard, [&] { return done() || queued.load() > 0; });
+    waiting--;
+  }
+}
+
+// Taking the lock orders the caller's update before the predicate check of
+// any thread about to sleep, so none misses it.
+void ThreadPool::notifyWaiters() {
+  {
+    std::lock_guard<std::mutex> guard(sleepLock);
+    if (waiting == 0) return;
+  }
+  progress.notify_all();
+}
+
+void ThreadPool::workerLoop(int index) {
+  workerPool = this;
+  workerIndex = index;
+  Task task;
+  while (true) {
+    if (popTask(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(sleepLock);
+    wake.wait(guard, [&] { return stopping || queued.load() > 0; });
+    if (stopping && queued.load() == 0) return;
+  }
+}
+
+TaskGroup::~TaskGroup() {
+  // Never leave tasks running that reference this group.
+  pool.waitUntil([this] { return pending.load() == 0; });
+}
+
+void TaskGroup::run(ThreadPool::Task task) {
+  pending.fetch_add(1);
+  pool.submit([this, task = std::move(task)] {
+    try {
+      task();
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(errorLock);
+      if (!error) error = std::current_exception();
+    }
+    // The group may be gone as soon as pending reaches zero.
+    ThreadPool& owner = pool;
+    if (pending.fetch_sub(1) == 1) owner.notifyWaiters();
+  });
+}
+
+void TaskGroup::wait() {
+  pool.waitUntil([this] { return pending.load() == 0; });
+  if (error) {
+    std::exception_ptr rethrown = error;
+    error = nullptr;
+    std::rethrow_exception(rethrown);
+  }
+}
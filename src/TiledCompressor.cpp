@@ -0,0 +1,148 @@
+#include "TiledCompressor.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#include "ImageCompressor.hpp"
+
+namespace {
+
+const Color kRootParent(128, 128, 128);  // as in QtcCodec
+const size_t kFlushBytes = 1 << 20;
+
+}  // namespace
+
+TiledCompressor::TiledCompressor(int errorMethod, double threshold,
+                                 int minBlockSize, int tileSize,
+                                 const BuildOptions& options)
+    : threshold(threshold),
+      minBlockSize(minBlockSize),
+      tileSize(tileSize),
+      buildOptions(options),
+      metric(createMetric(errorMethod)),
+      source(nullptr),
+      tileCount(0) {}
+
+// Blocks that fit in a tile, and blocks too small to split, are built as a
+// whole; everything above them is stitched from its quadrants.
+bool TiledCompressor::isTile(const Block& block) const {
+  return (block.width <= tileSize && block.height <= tileSize) ||
+         !block.canSplit(minBlockSize);
+}
+
+// Read the block from the source and build its quadtree. The block's depth is
+// only used for statistics, so the tile is built as a tree of its own.
+std::unique_ptr<Quadtree> TiledCompressor::buildTile(const Block& block) {
+  source->copyBlock(block, tile);
+  source->release(block);
+  return std::unique_ptr<Quadtree>(new Quadtree(
+      tile.view(), threshold, metric.get(), minBlockSize, buildOptions));
+}
+
+// First pass. The error of a block above the tiles is computed from the
+// merged summaries of its quadrants, so it is exactly the value a build over
+// the whole image would have computed from its pixels.
+TiledCompressor::Scanned TiledCompressor::scan(const Block& block) {
+  Scanned result;
+  if (isTile(block)) {
+    std::unique_ptr<Quadtree> tree = buildTile(block);
+    tileCount++;
+    result.summary = BlockSummary::of(tile.view(), metric->needsHistogram());
+    result.color = tree->getRoot().getColor();
+    result.split = !tree->getRoot().isLeaf();
+    result.counts.addDescendants(*tree);
+    return result;
+  }
+
+  size_t index = upper.size();
+  upper.push_back(UpperNode());
+  Scanned children[4];
+  for (int i = 0; i < 4; i++) {
+    children[i] = scan(block.child(i));
+    result.summary.add(children[i].summary);
+  }
+  float error = metric->compute(result.summary);
+  result.color = result.summary.average();
+  result.split = error >= threshold;
+  if (result.split) {
+    for (int i = 0; i < 4; i++) {
+      result.counts.addNode(result.color, children[i].color);
+      result.counts.add(children[i].counts);
+    }
+  }
+  upper[index] = UpperNode{result.color, result.split};
+  return result;
+}
+
+// Step over the upper nodes below a block that was not split.
+void TiledCompressor::skip(const Block& block, size_t& next) const {
+  if (isTile(block)) return;
+  next++;
+  for (int i = 0; i < 4; i++) skip(block.child(i), next);
+}
+
+// Second pass: write the visible nodes in stream order, rebuilding each
+// visible tile and flushing the output as it grows.
+void TiledCompressor::emit(const Block& block, const Color& parent,
+                           size_t& next, QtcEncoder& encoder,
+                           std::vector<uint8_t>& buffer, std::ostream& file) {
+  if (isTile(block)) {
+    encoder.writeTree(*buildTile(block), parent);
+    if (buffer.size() >= kFlushBytes) {
+      file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+      buffer.clear();
+    }
+    return;
+  }
+
+  const UpperNode node = upper[next++];
+  encoder.writeNode(parent, node.color, node.split);
+  for (int i = 0; i < 4; i++) {
+    if (node.split)
+      emit(block.child(i), node.color, next, encoder, buffer, file);
+    else
+      skip(block.child(i), next);
+  }
+}
+
+ByteCounts TiledCompressor::compress(const std::string& inputPath,
+                                     const std::string& outputPath,
+                                     RunStats& stats) {
+  MappedImage image(inputPath);
+  ByteCounts bytes;
+  bytes.input = static_cast<long long>(image.getFileSize());
+  source = &image;
+  upper.clear();
+  tileCount = 0;
+  Block root{0, 0, image.getWidth(), image.getHeight(), 0};
+
+  QtcSymbolCounts counts;
+  {
+    ScopedPhase phase(stats, "scan");
+    Scanned scanned = scan(root);
+    counts.addNode(kRootParent, scanned.color);
+    counts.add(scanned.counts);
+  }
+
+  {
+    ScopedPhase phase(stats, "encode");
+    std::ofstream file(outputPath, std::ios::binary);
+    if (!file) throw std::runtime_error("Cannot create " + outputPath);
+    std::vector<uint8_t> buffer;
+    QtcEncoder encoder(QtcHeader{root.width, root.height, minBlockSize},
+                       counts, buffer);
+    size_t next = 0;
+    emit(root, kRootParent, next, encoder, buffer, file);
+    encoder.finish();
+    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    if (!file) throw std::runtime_error("Failed to write " + outputPath);
+    bytes.output = static_cast<long long>(file.tellp());
+  }
+
+  stats.set("width", root.width);
+  stats.set("height", root.height);
+  stats.set("tile_size", tileSize);
+  stats.set("tiles", static_cast<double>(tileCount));
+  source = nullptr;
+  return bytes;
+}
@@ -0,0 +1,90 @@
+// Regression checks for the incremental compressors. Sequence and tiled mode
+// score blocks from merged summaries instead of a full build, and must still
+// write exactly what a full build writes, even when a block's error lands on
+// the threshold. Prints one line per check and exits non-zero on failure.
+//
+//   bin/boundary_test
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ImageCompressor.hpp"
+#include "Quadtree.hpp"
+#include "SequenceCompressor.hpp"
+#include "TiledCompressor.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// With Max Pixel Difference the root of the test image has an error of 1/3,
+// which reaches this threshold only once rounded to float, as the tree
+// stores it.
+const int kErrorMethod = 3;
+const double kThreshold = 0.33333334;
+const int kMinBlockSize = 4;
+const int kTileSize = 32;
+
+int failures = 0;
+
+void check(bool ok, const char* name) {
+  printf("%s %s\n", ok ? "[PASS]" : "[FAIL]", name);
+  if (!ok) failures++;
+}
+
+// A 128x128 (10,10,10) image whose top-left quadrant is (11,10,10).
+std::string writeInput(const fs::path& dir) {
+  std::string path = (dir / "boundary.ppm").string();
+  std::ofstream file(path, std::ios::binary);
+  file << "P6\n128 128\n255\n";
+  for (int y = 0; y < 128; y++)
+    for (int x = 0; x < 128; x++)
+      file.put(x < 64 && y < 64 ? 11 : 10).put(10).put(10);
+  if (!file) throw std::runtime_error("Cannot write " + path);
+  return path;
+}
+
+void run(const fs::path& dir) {
+  std::string input = writeInput(dir);
+
+  Image pixels = loadImage(input);
+  std::unique_ptr<Metric> metric = createMetric(kErrorMethod);
+  Quadtree tree(pixels.view(), kThreshold, metric.get(), kMinBlockSize);
+  check(tree.getNodeCount() > 1, "full build splits the root");
+  std::vector<uint8_t> jpeg, qtc;
+  encodeTree(tree, OutputFormat::Jpeg, jpeg);
+  encodeTree(tree, OutputFormat::Qtc, qtc);
+
+  RunStats stats;
+  std::string sequencePath = (dir / "sequence.jpg").string();
+  SequenceCompressor sequence(kErrorMethod, kThreshold, kMinBlockSize,
+                              kTileSize);
+  sequence.compress(input, sequencePath, stats);
+  check(readFile(sequencePath) == jpeg, "sequence mode matches a full build");
+
+  std::string tiledPath = (dir / "tiled.qtc").string();
+  TiledCompressor tiled(kErrorMethod, kThreshold, kMinBlockSize, kTileSize);
+  tiled.compress(input, tiledPath, stats);
+  check(readFile(tiledPath) == qtc, "tiled mode matches a full build");
+}
+
+}  // namespace
+
+int main() {
+  FreeImage_Initialise();
+  fs::path dir = fs::temp_directory_path() / "quadtree_boundary_test";
+  try {
+    fs::create_directories(dir);
+    run(dir);
+  } catch (const std::exception& e) {
+    fprintf(stderr, "Error: %s\n", e.what());
+    failures++;
+  }
+  fs::remove_all(dir);
+  FreeImage_DeInitialise();
+  return failures ? 1 : 0;
+}